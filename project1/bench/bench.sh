@@ -0,0 +1,15 @@
+#! /bin/bash
+
+# Generates the corpus once (in corpus/ next to this script), then benchmarks
+# every utility. Options after the script name go to run-bench.py, e.g.
+#   ./bench.sh -k wgrep
+# Set CORPUS_MB to change the corpus size; delete corpus/ to regenerate.
+
+cd "$(dirname "$0")"
+
+if [[ ! -d corpus ]]; then
+    echo "generating ${CORPUS_MB:-64} MB corpus"
+    ./gen-corpus.py -s ${CORPUS_MB:-64} corpus || exit 1
+fi
+
+./run-bench.py "$@" corpus
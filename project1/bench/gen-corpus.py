@@ -0,0 +1,66 @@
+#! /usr/bin/env python3
+
+# Writes the benchmark corpora into a directory. The same seed and size always
+# give byte-identical files, so numbers from different runs are comparable.
+#
+# usage: gen-corpus.py [-s size-mb] [-r seed] outdir
+
+import argparse
+import os
+import random
+import string
+
+WORDS_PER_LINE = 12
+
+
+def text(rng, size):
+    # Lines of lowercase words; "needle" is rare, "the" is everywhere
+    vocabulary = [''.join(rng.choice(string.ascii_lowercase) for _ in range(rng.randint(2, 9)))
+                  for _ in range(5000)] + ['the'] * 200
+    out = []
+    written = 0
+    while written < size:
+        line = ' '.join(rng.choice(vocabulary) for _ in range(WORDS_PER_LINE))
+        if rng.random() < 0.001:
+            line += ' needle'
+        out.append(line + '\n')
+        written += len(line) + 1
+    return ''.join(out).encode()[:size]
+
+
+def runs(rng, size):
+    # Long runs of one letter, the friendly case for run-length encoding
+    out = bytearray()
+    while len(out) < size:
+        out += bytes([rng.choice(b'abcdefgh\n')]) * rng.randint(1, 2000)
+    return bytes(out[:size])
+
+
+def binary(rng, size):
+    return rng.randbytes(size)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('-s', '--size-mb', type=int, default=64)
+    parser.add_argument('-r', '--seed', type=int, default=150)
+    parser.add_argument('outdir')
+    args = parser.parse_args()
+
+    size = args.size_mb << 20
+    rng = random.Random(args.seed)
+    os.makedirs(os.path.join(args.outdir, 'small'), exist_ok=True)
+
+    for name, generate in (('text', text), ('runs', runs), ('binary', binary)):
+        with open(os.path.join(args.outdir, name), 'wb') as f:
+            f.write(generate(rng, size))
+
+    # A quarter as much text again, as 4 KB shards
+    shards = text(rng, size // 4)
+    for i in range(0, len(shards), 4096):
+        with open(os.path.join(args.outdir, 'small', '%06d' % (i // 4096)), 'wb') as f:
+            f.write(shards[i:i + 4096])
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,90 @@
+#include <chrono>
+#include <cstdio>
+
+#include <fcntl.h> // for open
+#include <sys/resource.h> // for rusage
+#include <sys/wait.h> // for wait4
+#include <unistd.h> // for fork, execv, getopt, pipe
+
+using namespace std;
+
+// g++ -O2 -o measure measure.cpp -Wall -Werror
+// usage: measure [-o file | -p] program [arg ...]
+// Runs the program with stdout on /dev/null and prints its wall time in
+// seconds and peak RSS in KB. Linux carries the high-water mark of a process
+// across fork and exec, so the benchmark script launches programs from this
+// small binary rather than from Python.
+// -o sends stdout to a regular file, truncated first, and -p to a pipe that
+// measure reads and discards; the wall time includes draining the pipe.
+int main(int argc, char* argv[]) {
+    const char* outputPath = "/dev/null";
+    bool toPipe = false;
+    int option;
+
+    // + stops at the program, whose own options are not ours
+    while ((option = getopt(argc, argv, "+o:p")) != -1) {
+        if (option == 'o') {
+            outputPath = optarg;
+        }
+        else if (option == 'p') {
+            toPipe = true;
+        }
+        else {
+            optind = argc;
+            break;
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "measure: [-o file | -p] program [arg ...]\n");
+        return 1;
+    }
+
+    int output = -1;
+    int ends[2];
+
+    if (toPipe) {
+        if (pipe(ends) < 0) {
+            perror("measure");
+            return 1;
+        }
+        output = ends[1];
+    }
+    else if ((output = open(outputPath, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        perror("measure");
+        return 1;
+    }
+
+    auto start = chrono::steady_clock::now();
+    pid_t child = fork();
+
+    if (child == 0) {
+        dup2(output, STDOUT_FILENO);
+        close(output);
+        if (toPipe) close(ends[0]);
+        execv(argv[optind], argv + optind);
+        _exit(127);
+    }
+
+    close(output);
+
+    if (toPipe) {
+        static char buffer[1 << 17];
+        while (read(ends[0], buffer, sizeof(buffer)) > 0) {
+        }
+        close(ends[0]);
+    }
+
+    int status;
+    struct rusage usage;
+
+    if (child < 0 || wait4(child, &status, 0, &usage) < 0) {
+        perror("measure");
+        return 1;
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("%f %ld\n", seconds, usage.ru_maxrss);
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
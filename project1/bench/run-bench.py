@@ -0,0 +1,137 @@
+#! /usr/bin/env python3
+
+# Builds the project1 utilities with optimization and times them over a corpus
+# made by gen-corpus.py. For each workload it reports throughput (uncompressed
+# MB per second of wall time, best of the repeats), the number of system calls
+# (when strace is installed) and the peak resident set size. Standard output
+# goes to /dev/null unless the workload names a regular file or a pipe.
+#
+# usage: run-bench.py [-n repeats] [-k filter] corpusdir
+
+import argparse
+import glob
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SOURCES = os.path.join(HERE, '..', 'initial-utilities')
+TOOLS = ('wcat', 'wgrep', 'wzip', 'wunzip')
+
+
+def build(outdir):
+    sources = [(tool, os.path.join(SOURCES, tool, tool + '.cpp')) for tool in TOOLS]
+    sources.append(('measure', os.path.join(HERE, 'measure.cpp')))
+    for name, source in sources:
+        subprocess.run(['g++', '-O2', '-o', os.path.join(outdir, name), source,
+                        '-Wall', '-Werror', '-pthread'], check=True)
+
+
+def workloads(corpus, bin, scratch):
+    text = os.path.join(corpus, 'text')
+    runs = os.path.join(corpus, 'runs')
+    binary = os.path.join(corpus, 'binary')
+    small = sorted(glob.glob(os.path.join(corpus, 'small', '*')))
+
+    # wunzip needs zipped inputs; making them is not part of any timing
+    zipped = {}
+    for name, path in (('runs', runs), ('text', text)):
+        zipped[name] = os.path.join(scratch, name + '.z')
+        with open(zipped[name], 'wb') as out:
+            subprocess.run([os.path.join(bin, 'wzip'), path], stdout=out, check=True)
+
+    tool = lambda name: os.path.join(bin, name)
+    # (name, command, stdout, uncompressed bytes); stdout is 'null', 'file' or
+    # 'pipe', and the bytes default to the size of the input files
+    return [
+        ('wcat text', [tool('wcat'), text], 'null', None),
+        ('wcat text > file', [tool('wcat'), text], 'file', None),
+        ('wcat text | pipe', [tool('wcat'), text], 'pipe', None),
+        ('wcat small files', [tool('wcat')] + small, 'null', None),
+        ('wcat small files > file', [tool('wcat')] + small, 'file', None),
+        ('wcat -m small files', [tool('wcat'), '-m'] + small, 'null', None),
+        ('wgrep rare term', [tool('wgrep'), 'needle', text], 'null', None),
+        ('wgrep dense term', [tool('wgrep'), 'the', text], 'null', None),
+        ('wgrep dense term | pipe', [tool('wgrep'), 'the', text], 'pipe', None),
+        ('wgrep -c dense term', [tool('wgrep'), '-c', 'the', text], 'null', None),
+        ('wgrep -j 4 small files', [tool('wgrep'), '-j', '4', 'needle'] + small, 'null', None),
+        ('wzip runs', [tool('wzip'), runs], 'null', None),
+        ('wzip text', [tool('wzip'), text], 'null', None),
+        ('wzip text > file', [tool('wzip'), text], 'file', None),
+        ('wzip binary', [tool('wzip'), binary], 'null', None),
+        ('wzip -j 4 runs', [tool('wzip'), '-j', '4', runs], 'null', None),
+        # wunzip is rated by what it writes, not by its smaller input
+        ('wunzip runs', [tool('wunzip'), zipped['runs']], 'null', os.path.getsize(runs)),
+        ('wunzip text', [tool('wunzip'), zipped['text']], 'null', os.path.getsize(text)),
+        ('wunzip text > file', [tool('wunzip'), zipped['text']], 'file', os.path.getsize(text)),
+        ('wunzip text | pipe', [tool('wunzip'), zipped['text']], 'pipe', os.path.getsize(text)),
+    ]
+
+
+def input_bytes(command):
+    return sum(os.path.getsize(arg) for arg in command[1:] if os.path.isfile(arg))
+
+
+# The measure options that send stdout where the workload asks
+def output_options(stdout, scratch):
+    if stdout == 'file':
+        return ['-o', os.path.join(scratch, 'stdout')]
+    if stdout == 'pipe':
+        return ['-p']
+    return []
+
+
+# Runs command under measure; returns (seconds, peak RSS in KB)
+def timed_run(command, stdout, bin, scratch):
+    result = subprocess.run([os.path.join(bin, 'measure')] + output_options(stdout, scratch) + command,
+                            stdout=subprocess.PIPE, text=True)
+    if result.returncode != 0:
+        sys.exit('%s exited with %d' % (command[0], result.returncode))
+    seconds, peak = result.stdout.split()
+    return float(seconds), int(peak)
+
+
+def syscall_count(command, stdout, bin, scratch):
+    strace = shutil.which('strace')
+    if strace is None:
+        return None
+    summary = os.path.join(scratch, 'strace.out')
+    subprocess.run([os.path.join(bin, 'measure')] + output_options(stdout, scratch)
+                   + [strace, '-f', '-c', '-o', summary] + command, stdout=subprocess.DEVNULL, check=True)
+    with open(summary) as f:
+        # % time, seconds, usecs/call, calls, [errors,] total
+        match = re.search(r'^\s*[\d.]+\s+[\d.]+\s+\d+\s+(\d+)\s+(?:\d+\s+)?total$', f.read(), re.M)
+    return int(match.group(1)) if match else None
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('-n', '--repeats', type=int, default=3)
+    parser.add_argument('-k', '--filter', default='', help='only workloads whose name contains this')
+    parser.add_argument('corpus')
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as scratch:
+        build(scratch)
+
+        print('%-26s %10s %12s %10s' % ('workload', 'MB/s', 'syscalls', 'peak MB'))
+
+        for name, command, stdout, size in workloads(args.corpus, scratch, scratch):
+            if args.filter not in name:
+                continue
+
+            results = [timed_run(command, stdout, scratch, scratch) for _ in range(args.repeats)]
+            seconds = min(result[0] for result in results)
+            peak = max(result[1] for result in results)
+            syscalls = syscall_count(command, stdout, scratch, scratch)
+            size = input_bytes(command) if size is None else size
+
+            print('%-26s %10.0f %12s %10.1f' % (name, size / (1 << 20) / seconds,
+                                                 'n/a' if syscalls is None else syscalls, peak / 1024))
+
+
+if __name__ == '__main__':
+    main()
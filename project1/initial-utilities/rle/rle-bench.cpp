@@ -0,0 +1,109 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "rle.h"
+
+using namespace std;
+
+// Counts decoded bytes without keeping them
+struct CountingSink {
+    size_t* total;
+
+    void operator()(const char* data, size_t size) {
+        *total += size;
+    }
+};
+
+const size_t PIECE_SIZE = 1 << 17; // what wzip and wunzip read at a time
+
+string encode(const string & input, RleFormat format) {
+    RleEncoder encoder(format);
+    string encoded;
+
+    encoder.startStream();
+
+    for (size_t position = 0; position < input.size(); position += PIECE_SIZE) {
+        encoder.feed(input.data() + position, min(PIECE_SIZE, input.size() - position));
+        encoded.append(encoder.output(), encoder.outputSize());
+        encoder.clearOutput();
+    }
+
+    encoder.finish();
+    return encoded.append(encoder.output(), encoder.outputSize());
+}
+
+size_t decode(const string & encoded) {
+    size_t total = 0;
+    unique_ptr<RleDecoder<CountingSink>> decoder(new RleDecoder<CountingSink>(CountingSink{&total}));
+
+    decoder->startStream();
+
+    for (size_t position = 0; position < encoded.size(); position += PIECE_SIZE) {
+        decoder->feed(encoded.data() + position, min(PIECE_SIZE, encoded.size() - position));
+    }
+
+    decoder->flush();
+    return total;
+}
+
+template <typename Function>
+double secondsFor(Function function) {
+    auto start = chrono::steady_clock::now();
+    function();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// g++ -O2 -o rle-bench rle-bench.cpp -Wall -Werror
+// usage: ./rle-bench [megabytes]
+// Encodes and decodes in memory, in both formats, inputs of long runs, short
+// runs and random bytes, and reports MB/s of uncompressed data and the
+// encoded size as a percentage of the input.
+int main(int argc, char* argv[]) {
+    size_t megabytes = argc > 1 ? atoi(argv[1]) : 64;
+    vector<pair<string, string>> inputs = { { "long runs", "" }, { "short runs", "" }, { "random", "" } };
+
+    mt19937 random(150);
+
+    for (auto & input : inputs) {
+        string & data = input.second;
+        data.reserve(megabytes << 20);
+
+        while (data.size() < megabytes << 20) {
+            char letter = 'a' + random() % 4;
+            size_t length = 1;
+
+            if (input.first == "long runs") length = 1 + random() % 2000;
+            if (input.first == "short runs") length = 1 + random() % 4;
+            if (input.first == "random") letter = random();
+
+            data.append(min(length, (megabytes << 20) - data.size()), letter);
+        }
+    }
+
+    printf("%-12s %-8s %12s %12s %8s\n", "input", "format", "encode MB/s", "decode MB/s", "size");
+
+    for (const auto & input : inputs) {
+        for (RleFormat format : { RLE_LEGACY, RLE_COMPACT }) {
+            string encoded;
+            size_t decoded = 0;
+
+            double encodeSeconds = secondsFor([&] { encoded = encode(input.second, format); });
+            double decodeSeconds = secondsFor([&] { decoded = decode(encoded); });
+
+            if (decoded != input.second.size()) {
+                printf("mismatch for %s: %zu bytes decoded\n", input.first.c_str(), decoded);
+                return 1;
+            }
+
+            printf("%-12s %-8s %12.0f %12.0f %7.1f%%\n", input.first.c_str(), format == RLE_LEGACY ? "legacy" : "compact",
+                   megabytes / encodeSeconds, megabytes / decodeSeconds, 100.0 * encoded.size() / input.second.size());
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,228 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <unistd.h> // for getopt
+
+#include "rle.h"
+
+using namespace std;
+
+// Decoded bytes are appended to a string
+struct StringSink {
+    string* target;
+
+    void operator()(const char* data, size_t size) {
+        target->append(data, size);
+    }
+};
+
+// Random bytes with a random mix of short runs, long runs and alphabet size
+string makeInput(mt19937 & random, size_t maxSize) {
+    size_t size = random() % (maxSize + 1);
+    int alphabet = 1 + random() % (random() % 2 ? 4 : 256);
+    int style = random() % 3;
+    string input;
+
+    while (input.size() < size) {
+        char letter = random() % alphabet;
+        size_t length = 1;
+
+        if (style == 1) length = 1 + random() % 8;
+        if (style == 2) length = random() % 16 == 0 ? random() % 200000 : 1 + random() % 300;
+
+        input.append(min(length, size - input.size()), letter);
+    }
+
+    return input;
+}
+
+// A random split point for feeding the rest of a buffer in pieces
+size_t pieceSize(mt19937 & random, size_t left) {
+    size_t limits[] = { 1, 7, 4096, left };
+    return min(left, 1 + random() % limits[random() % 4]);
+}
+
+string encodeWhole(const string & input, RleFormat format, uint64_t interval, mt19937 & random) {
+    RleEncoder encoder(format, false, interval);
+    string encoded;
+    size_t position = 0;
+
+    encoder.startStream();
+
+    while (position < input.size()) {
+        size_t size = pieceSize(random, input.size() - position);
+        encoder.feed(input.data() + position, size);
+        position += size;
+
+        if (random() % 4 == 0) {
+            encoded.append(encoder.output(), encoder.outputSize());
+            encoder.clearOutput();
+        }
+    }
+
+    encoder.finish();
+    return encoded.append(encoder.output(), encoder.outputSize());
+}
+
+// Encodes random chunks on their own and joins them the way wzip -j does
+string encodeChunks(const string & input, RleFormat format, uint64_t interval, mt19937 & random) {
+    RleEncoder encoder(format, false, interval);
+    size_t position = 0;
+
+    encoder.startStream();
+
+    while (position < input.size()) {
+        size_t size = pieceSize(random, input.size() - position);
+        RleEncoder chunk(format, true, interval);
+
+        chunk.feed(input.data() + position, size);
+        chunk.endLiteral();
+        position += size;
+
+        encoder.addRun(chunk.firstRun.letter, chunk.firstRun.count);
+        if (chunk.outputSize() > 0) encoder.append(chunk);
+        encoder.addRun(chunk.run.letter, chunk.run.count);
+    }
+
+    encoder.finish();
+    return string(encoder.output(), encoder.outputSize());
+}
+
+// Decodes encoded[from, to) in random pieces, keeping the given window
+string decode(const string & encoded, size_t from, size_t to, RleFormat format, uint64_t skip, int64_t length,
+              mt19937 & random) {
+    string decoded;
+    unique_ptr<RleDecoder<StringSink>> decoder(new RleDecoder<StringSink>(StringSink{&decoded}));
+
+    decoder->startStream(format);
+    if (length >= 0) decoder->setWindow(skip, length);
+
+    while (from < to && !decoder->isFull()) {
+        size_t size = pieceSize(random, to - from);
+        decoder->feed(encoded.data() + from, size);
+        from += size;
+    }
+
+    decoder->flush();
+
+    return decoded;
+}
+
+// Checks one encoding of input: its index, if it has one, a full round trip
+// and random windows decoded from the checkpoints. Returns a description of
+// what went wrong, or an empty string.
+string checkEncoding(const string & input, const string & encoded, RleFormat format, uint64_t interval,
+                     mt19937 & random) {
+    size_t dataSize = encoded.size();
+    vector<RleCheckpoint> checkpoints;
+
+    if (interval > 0) {
+        uint64_t count;
+
+        if (encoded.size() < (size_t) RLE_FOOTER_SIZE
+            || !rleReadFooter(encoded.data() + encoded.size() - RLE_FOOTER_SIZE, count)) {
+            return "no index footer";
+        }
+
+        dataSize = encoded.size() - RLE_FOOTER_SIZE - count * sizeof(RleCheckpoint);
+        checkpoints.resize(count);
+        memcpy(checkpoints.data(), encoded.data() + dataSize, count * sizeof(RleCheckpoint));
+    }
+
+    if (decode(encoded, 0, dataSize, RLE_UNKNOWN, 0, -1, random) != input) {
+        return "round trip differs";
+    }
+
+    for (int i = 0; i < 4; ++i) {
+        uint64_t start = random() % (input.size() + 2);
+        int64_t length = random() % (random() % 2 ? 16 : input.size() + 2);
+        RleCheckpoint from{0, 0};
+
+        for (const RleCheckpoint & checkpoint : checkpoints) {
+            if (checkpoint.uncompressed > start) break;
+            from = checkpoint;
+        }
+
+        RleFormat startFormat = from.compressed > 0 ? format : RLE_UNKNOWN;
+        string window = decode(encoded, from.compressed, dataSize, startFormat, start - from.uncompressed, length, random);
+
+        if (window != input.substr(min(start, (uint64_t) input.size()), length)) {
+            return "window " + to_string(start) + ":" + to_string(length) + " differs";
+        }
+    }
+
+    return "";
+}
+
+// Checks one input in one format, encoded whole and in chunks; returns a
+// description of what went wrong, or an empty string
+string check(const string & input, RleFormat format, uint64_t interval, mt19937 & random) {
+    string encoded = encodeWhole(input, format, interval, random);
+    string chunked = encodeChunks(input, format, interval, random);
+
+    if (format == RLE_LEGACY && interval == 0 && chunked != encoded) {
+        return "chunked encoding differs";
+    }
+
+    string problem = checkEncoding(input, encoded, format, interval, random);
+
+    if (problem.empty()) {
+        problem = checkEncoding(input, chunked, format, interval, random);
+        if (!problem.empty()) problem = "chunked " + problem;
+    }
+
+    return problem;
+}
+
+// g++ -O2 -o rle-fuzz rle-fuzz.cpp -Wall -Werror
+// usage: ./rle-fuzz [-s seed] [-n cases] [-m maxsize]
+// Round-trips random inputs through RleEncoder and RleDecoder in both formats,
+// with and without an index, feeding every buffer in random pieces. Each input
+// is also encoded in chunks joined with append(), and each encoding, with its
+// own index, is checked by decoding random windows from its checkpoints.
+int main(int argc, char* argv[]) {
+    unsigned seed = 1;
+    int cases = 200;
+    size_t maxSize = 20000;
+    int option;
+
+    while ((option = getopt(argc, argv, "s:n:m:")) != -1) {
+        if (option == 's') {
+            seed = atoi(optarg);
+        }
+        else if (option == 'n') {
+            cases = atoi(optarg);
+        }
+        else if (option == 'm') {
+            maxSize = atoi(optarg);
+        }
+        else {
+            fprintf(stderr, "rle-fuzz: [-s seed] [-n cases] [-m maxsize]\n");
+            return 1;
+        }
+    }
+
+    mt19937 random(seed);
+
+    for (int i = 0; i < cases; ++i) {
+        string input = makeInput(random, maxSize);
+        RleFormat format = random() % 2 ? RLE_COMPACT : RLE_LEGACY;
+        uint64_t interval = random() % 2 ? 0 : 1 + random() % 5000;
+        string problem = check(input, format, interval, random);
+
+        if (!problem.empty()) {
+            printf("case %d (%zu bytes, %s, interval %llu): %s\n", i, input.size(),
+                   format == RLE_COMPACT ? "compact" : "legacy", (unsigned long long) interval, problem.c_str());
+            return 1;
+        }
+    }
+
+    printf("%d cases passed\n", cases);
+
+    return 0;
+}
@@ -0,0 +1,552 @@
+#ifndef _RLE_H_
+#define _RLE_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Streaming run-length codec used by wzip and wunzip. There are two formats:
+//
+//   legacy    5-byte records: a native int32 count, then the letter
+//   compact   RLE_COMPACT_MAGIC, then tokens, each a varint v followed by
+//             either one letter (a run of v >> 1 bytes, if v is even) or
+//             v >> 1 bytes copied as they are (a literal block, if v is odd)
+//
+// Read as a legacy record the compact magic has a negative count, which the
+// encoder never writes, so a decoder can tell the formats apart. Either may be
+// followed by an index: RleCheckpoint[count], each the input and output
+// offsets of a record or token, then a footer of the count, the input size and
+// RLE_INDEX_MAGIC.
+//
+// RleEncoder collects its output in a buffer that the caller takes from
+// output() and outputSize() and hands back with clearOutput(). RleDecoder passes the bytes it
+// expands to a sink functor, called as sink(data, size) with large spans.
+
+enum RleFormat { RLE_UNKNOWN, RLE_LEGACY, RLE_COMPACT };
+
+const int RLE_RECORD_SIZE = 5;
+const int RLE_LETTER_POS = 4;
+const int64_t RLE_MAX_RECORD_COUNT = INT32_MAX;
+const char RLE_COMPACT_MAGIC[4] = { 'W', 'Z', '2', (char) 0xff };
+const int RLE_MAGIC_SIZE = 4;
+const int64_t RLE_MIN_COMPACT_RUN = 3; // shorter runs are smaller inside literal blocks
+const size_t RLE_MAX_LITERAL_SIZE = 1 << 16;
+const size_t RLE_OUTPUT_RESERVE = 1 << 16; // output buffer an encoder starts with
+const char RLE_INDEX_MAGIC[8] = { 'W', 'Z', 'I', 'N', 'D', 'E', 'X', '1' };
+const int RLE_INDEX_MAGIC_SIZE = 8;
+const int RLE_FOOTER_SIZE = 2 * sizeof(uint64_t) + RLE_INDEX_MAGIC_SIZE;
+
+struct RleCheckpoint {
+  uint64_t uncompressed; // offset in the decoded bytes
+  uint64_t compressed; // offset in the encoded bytes
+};
+
+// A run of one letter; count 0 means no run
+struct RleRun {
+  char letter = '\0';
+  int64_t count = 0;
+};
+
+// Returns how many bytes from begin equal letter, comparing a vector at a time
+inline size_t rleRunLength(const char *begin, const char *end, char letter) {
+  const char *p = begin;
+
+#if defined(__AVX2__)
+  const __m256i target = _mm256_set1_epi8(letter);
+
+  while (end - p >= 32) {
+    unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) p), target));
+    if (mask != 0xffffffff) return p - begin + __builtin_ctz(~mask);
+    p += 32;
+  }
+#elif defined(__SSE2__)
+  const __m128i target = _mm_set1_epi8(letter);
+
+  while (end - p >= 16) {
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) p), target));
+    if (mask != 0xffff) return p - begin + __builtin_ctz(~mask);
+    p += 16;
+  }
+#endif
+
+  while (p < end && *p == letter) {
+    ++p;
+  }
+
+  return p - begin;
+}
+
+inline bool rleIsCompact(const char *data, size_t size) {
+  return size >= (size_t) RLE_MAGIC_SIZE && memcmp(data, RLE_COMPACT_MAGIC, RLE_MAGIC_SIZE) == 0;
+}
+
+// Reads the checkpoint count from the last RLE_FOOTER_SIZE bytes of a stream;
+// false if they are not an index footer
+inline bool rleReadFooter(const char *footer, uint64_t &count) {
+  if (memcmp(footer + 2 * sizeof(uint64_t), RLE_INDEX_MAGIC, RLE_INDEX_MAGIC_SIZE) != 0) {
+    return false;
+  }
+
+  memcpy(&count, footer, sizeof(uint64_t));
+  return true;
+}
+
+// Turns blocks of input into records or tokens. Runs may continue across
+// blocks; the last one is only encoded by finish(). With holdFirstRun the
+// first finished run is kept in firstRun instead, so that the encoding of one
+// chunk of a stream can be joined to its neighbours with append(). A
+// checkpointInterval above 0 makes finish() add an index.
+class RleEncoder {
+ public:
+  explicit RleEncoder(RleFormat format = RLE_LEGACY, bool holdFirstRun = false, uint64_t checkpointInterval = 0)
+      : format(format), holdFirstRun(holdFirstRun), checkpointInterval(checkpointInterval) {}
+
+  // Starts a whole stream, which in the compact format opens with the magic
+  void startStream() {
+    if (format == RLE_COMPACT) put(RLE_COMPACT_MAGIC, RLE_MAGIC_SIZE);
+  }
+
+  void feed(const char *data, size_t size) {
+    const char *end = data + size;
+
+    while (data < end) {
+      size_t length = rleRunLength(data, end, *data);
+      addRun(*data, length);
+      data += length;
+    }
+  }
+
+  void addRun(char letter, int64_t length) {
+    if (length == 0) return;
+
+    if (run.count > 0 && letter == run.letter) {
+      run.count += length;
+      return;
+    }
+
+    endRun();
+    run.letter = letter;
+    run.count = length;
+  }
+
+  // Ends the current run, then adds the output of an encoder that held its
+  // first run, taking its checkpoints where they fit this one's interval
+  void append(const RleEncoder &other) {
+    endRun();
+    endLiteral();
+
+    for (const RleCheckpoint &checkpoint : other.checkpoints) {
+      markToken(position + checkpoint.uncompressed, written + used + checkpoint.compressed);
+    }
+
+    position += other.position;
+    put(other.records.data(), other.used);
+  }
+
+  // Closes the literal block being collected, so that the output ends on a
+  // whole token
+  void endLiteral() {
+    if (literal.empty()) return;
+
+    if (checkpointInterval > 0) markToken(position - literal.size(), written + used);
+    appendVarint(literal.size() << 1 | 1);
+    put(literal.data(), literal.size());
+    literal.clear();
+  }
+
+  void finish() {
+    endRun();
+    endLiteral();
+    if (checkpointInterval > 0) appendIndex();
+  }
+
+  // Encoded bytes not yet taken by the caller
+  const char *output() const {
+    return records.data();
+  }
+
+  size_t outputSize() const {
+    return used;
+  }
+
+  void clearOutput() {
+    written += used;
+    used = 0;
+  }
+
+  RleRun firstRun;
+  RleRun run; // still growing
+  std::vector<RleCheckpoint> checkpoints;
+
+ private:
+  void endRun() {
+    if (run.count == 0) return;
+
+    if (holdFirstRun) {
+      firstRun = run;
+      holdFirstRun = false;
+    }
+    else {
+      encode(run.letter, run.count);
+    }
+
+    run.count = 0;
+  }
+
+  void encode(char letter, int64_t count) {
+    if (format == RLE_COMPACT) {
+      if (count < RLE_MIN_COMPACT_RUN) {
+        literal.append(count, letter);
+        position += count;
+        if (literal.size() >= RLE_MAX_LITERAL_SIZE) endLiteral();
+      }
+      else {
+        endLiteral();
+        if (checkpointInterval > 0) markToken(position, written + used);
+        appendVarint(count << 1);
+        put(&letter, 1);
+        position += count;
+      }
+
+      return;
+    }
+
+    // A run too long for one count becomes several records
+    while (count > 0) {
+      int32_t recordCount = std::min(count, RLE_MAX_RECORD_COUNT);
+      char *record = reserve(RLE_RECORD_SIZE);
+
+      if (checkpointInterval > 0) markToken(position, written + used);
+      memcpy(record, &recordCount, sizeof(int32_t));
+      record[RLE_LETTER_POS] = letter;
+      used += RLE_RECORD_SIZE;
+      count -= recordCount;
+      position += recordCount;
+    }
+  }
+
+  void appendVarint(uint64_t value) {
+    char *next = reserve(10); // a varint of 64 bits takes at most 10 bytes
+
+    while (value >= 0x80) {
+      *next++ = (char) (value | 0x80);
+      value >>= 7;
+    }
+
+    *next++ = (char) value;
+    used = next - records.data();
+  }
+
+  // Makes room for size more bytes of output, returning where they go. The
+  // buffer only grows, so once the caller takes output regularly it stops
+  // being reallocated.
+  char *reserve(size_t size) {
+    if (used + size > records.size()) {
+      records.resize(std::max(std::max(2 * records.size(), used + size), RLE_OUTPUT_RESERVE));
+    }
+
+    return records.data() + used;
+  }
+
+  void put(const char *data, size_t size) {
+    memcpy(reserve(size), data, size);
+    used += size;
+  }
+
+  // Notes a checkpoint if a record or token starting here is the first past
+  // the next multiple of the interval
+  void markToken(uint64_t uncompressed, uint64_t compressed) {
+    if (checkpointInterval == 0 || uncompressed < nextCheckpoint) return;
+
+    checkpoints.push_back(RleCheckpoint{uncompressed, compressed});
+    nextCheckpoint = (uncompressed / checkpointInterval + 1) * checkpointInterval;
+  }
+
+  void appendIndex() {
+    put((const char *) checkpoints.data(), checkpoints.size() * sizeof(RleCheckpoint));
+
+    uint64_t count = checkpoints.size();
+    put((const char *) &count, sizeof(uint64_t));
+    put((const char *) &position, sizeof(uint64_t));
+    put(RLE_INDEX_MAGIC, RLE_INDEX_MAGIC_SIZE);
+  }
+
+  RleFormat format;
+  bool holdFirstRun;
+  uint64_t checkpointInterval;
+  uint64_t nextCheckpoint = 0;
+  std::vector<char> records;
+  size_t used = 0; // bytes of records holding output
+  std::string literal; // short runs not yet in a literal block
+  uint64_t position = 0; // input bytes in records and literal
+  uint64_t written = 0; // output bytes already taken
+};
+
+// Expands records or tokens fed in blocks that may end anywhere, into a large
+// buffer handed to the sink when full. Long runs go to the sink straight from
+// a buffer filled with their letter, which is only refilled when the letter of
+// a long run changes. setWindow() keeps only part of the decoded bytes. The
+// buffers make a decoder over a megabyte, so it is best not on the stack.
+template <typename Sink>
+class RleDecoder {
+ public:
+  static constexpr size_t OUTPUT_BUFFER_SIZE = 1 << 20;
+  static constexpr size_t RUN_BUFFER_SIZE = 1 << 16; // runs at least this long skip the output buffer
+  static constexpr size_t SHORT_RUN = 8; // the bytes of a uint64_t
+
+  explicit RleDecoder(Sink sink = Sink()) : sink(sink) {}
+
+  // Begins the next stream, whose format is told from its first bytes unless
+  // given. Output not yet handed to the sink is kept.
+  void startStream(RleFormat streamFormat = RLE_UNKNOWN) {
+    format = streamFormat;
+    headerSize = 0;
+    partialSize = 0;
+    value = 0;
+    shift = 0;
+    needLetter = false;
+    literalLeft = 0;
+  }
+
+  // Drops the first skip bytes decoded and everything after the next length
+  void setWindow(uint64_t skip, uint64_t length) {
+    windowed = true;
+    skipLeft = skip;
+    wanted = length;
+  }
+
+  // Whether the window has been filled, so no more input is needed
+  bool isFull() const {
+    return windowed && wanted == 0;
+  }
+
+  void feed(const char *data, size_t size) {
+    if (format == RLE_UNKNOWN) {
+      size_t length = std::min(size, RLE_MAGIC_SIZE - headerSize);
+      memcpy(header + headerSize, data, length);
+      headerSize += length;
+      data += length;
+      size -= length;
+
+      if (headerSize < (size_t) RLE_MAGIC_SIZE) return;
+
+      if (rleIsCompact(header, headerSize)) {
+        format = RLE_COMPACT;
+      }
+      else {
+        format = RLE_LEGACY;
+        feedRecords(header, headerSize);
+      }
+    }
+
+    if (format == RLE_COMPACT) {
+      feedTokens(data, size);
+    }
+    else {
+      feedRecords(data, size);
+    }
+  }
+
+  void addRun(char letter, int64_t count) {
+    if (count <= 0) return;
+
+    if (windowed) {
+      uint64_t skipped = std::min((uint64_t) count, skipLeft);
+      skipLeft -= skipped;
+      count = std::min(count - skipped, wanted);
+      wanted -= count;
+
+      if (count == 0) return;
+    }
+
+    if ((size_t) count >= RUN_BUFFER_SIZE) {
+      flush();
+
+      if (runLetter != letter || !runFilled) {
+        memset(runBuffer, letter, RUN_BUFFER_SIZE);
+        runLetter = letter;
+        runFilled = true;
+      }
+
+      while (count > 0) {
+        size_t size = std::min((size_t) count, RUN_BUFFER_SIZE);
+        sink(runBuffer, size);
+        count -= size;
+      }
+
+      return;
+    }
+
+    if (used + count > OUTPUT_BUFFER_SIZE) flush();
+
+    memset(buffer + used, letter, count);
+    used += count;
+  }
+
+  void addLiteral(const char *data, size_t size) {
+    if (windowed) {
+      uint64_t skipped = std::min((uint64_t) size, skipLeft);
+      skipLeft -= skipped;
+      data += skipped;
+      size = std::min(size - skipped, wanted);
+      wanted -= size;
+    }
+
+    if (used + size > OUTPUT_BUFFER_SIZE) flush();
+
+    if (size > OUTPUT_BUFFER_SIZE) {
+      sink(data, size);
+      return;
+    }
+
+    memcpy(buffer + used, data, size);
+    used += size;
+  }
+
+  // Hands everything decoded so far to the sink
+  void flush() {
+    if (used > 0) sink(buffer, used);
+    used = 0;
+  }
+
+  Sink sink;
+
+ private:
+  // A record split between two blocks waits in partial
+  void feedRecords(const char *data, size_t size) {
+    if (partialSize > 0) {
+      size_t length = std::min(size, RLE_RECORD_SIZE - partialSize);
+      memcpy(partial + partialSize, data, length);
+      partialSize += length;
+      data += length;
+      size -= length;
+
+      if (partialSize < (size_t) RLE_RECORD_SIZE) return;
+
+      addRecord(partial);
+      partialSize = 0;
+    }
+
+    while (size >= (size_t) RLE_RECORD_SIZE && !isFull()) {
+      if (!windowed) {
+        size_t shortRecords = addShortRecords(data, size / RLE_RECORD_SIZE);
+        data += shortRecords * RLE_RECORD_SIZE;
+        size -= shortRecords * RLE_RECORD_SIZE;
+
+        if (size < (size_t) RLE_RECORD_SIZE) break;
+      }
+
+      addRecord(data);
+      data += RLE_RECORD_SIZE;
+      size -= RLE_RECORD_SIZE;
+    }
+
+    if (size < (size_t) RLE_RECORD_SIZE) {
+      memcpy(partial, data, size);
+      partialSize = size;
+    }
+  }
+
+  // Expands records of runs of 1 to SHORT_RUN bytes, which are most of them
+  // in poorly compressed files, in a tight loop: each stores SHORT_RUN copies
+  // of its letter at once past the used part of the buffer and keeps as many
+  // as its count. Stops at the first other record; returns how many records
+  // were expanded.
+  size_t addShortRecords(const char *records, size_t count) {
+    size_t done = 0;
+
+    while (done < count) {
+      size_t limit = std::min(count, done + (OUTPUT_BUFFER_SIZE - used) / SHORT_RUN);
+
+      for (; done < limit; ++done) {
+        const char *record = records + done * RLE_RECORD_SIZE;
+        int32_t length;
+        uint64_t letters = 0x0101010101010101ULL * (unsigned char) record[RLE_LETTER_POS];
+
+        memcpy(&length, record, sizeof(int32_t));
+        if ((uint32_t) length - 1 >= SHORT_RUN) break;
+
+        memcpy(buffer + used, &letters, SHORT_RUN);
+        used += length;
+      }
+
+      if (done < limit || done == count) return done;
+      flush();
+    }
+
+    return done;
+  }
+
+  void addRecord(const char *record) {
+    int32_t count;
+    memcpy(&count, record, sizeof(int32_t));
+    addRun(record[RLE_LETTER_POS], count);
+  }
+
+  void feedTokens(const char *data, size_t size) {
+    const char *end = data + size;
+
+    while (data < end && !isFull()) {
+      if (literalLeft > 0) {
+        size_t length = std::min((uint64_t) (end - data), literalLeft);
+        addLiteral(data, length);
+        data += length;
+        literalLeft -= length;
+      }
+      else if (needLetter) {
+        addRun(*data++, value >> 1);
+        needLetter = false;
+        value = 0;
+        shift = 0;
+      }
+      else {
+        unsigned char byte = *data++;
+
+        // Bits past 64 can only come from a damaged stream
+        if (shift < 64) value |= (uint64_t) (byte & 0x7f) << shift;
+        shift += 7;
+
+        if (byte & 0x80) continue;
+
+        if (value & 1) {
+          literalLeft = value >> 1;
+          value = 0;
+          shift = 0;
+        }
+        else {
+          needLetter = true;
+        }
+      }
+    }
+  }
+
+  RleFormat format = RLE_UNKNOWN;
+  char header[RLE_MAGIC_SIZE];
+  size_t headerSize = 0;
+  char partial[RLE_RECORD_SIZE];
+  size_t partialSize = 0;
+  uint64_t value = 0; // varint read so far
+  int shift = 0;
+  bool needLetter = false;
+  uint64_t literalLeft = 0;
+
+  bool windowed = false;
+  uint64_t skipLeft = 0;
+  uint64_t wanted = 0;
+
+  char buffer[OUTPUT_BUFFER_SIZE];
+  size_t used = 0;
+  char runBuffer[RUN_BUFFER_SIZE];
+  char runLetter = '\0';
+  bool runFilled = false;
+};
+
+#endif
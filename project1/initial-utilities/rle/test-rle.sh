@@ -0,0 +1,10 @@
+#! /bin/bash
+
+if ! [[ -x rle-fuzz ]]; then
+    echo "rle-fuzz executable does not exist"
+    exit 1
+fi
+
+../../tester/run-tests.sh $*
+
+
@@ -0,0 +1,82 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "matcher.h"
+
+using namespace std;
+
+// Counts the matches of term in text with std::string::find
+size_t countStd(const string & text, const string & term) {
+    size_t count = 0;
+
+    for (size_t pos = text.find(term); pos != string::npos; pos = text.find(term, pos + 1)) {
+        ++count;
+    }
+
+    return count;
+}
+
+size_t countMatcher(const string & text, const Matcher & matcher) {
+    size_t count = 0;
+    const char* end = text.data() + text.size();
+
+    for (const char* p = matcher.find(text.data(), end); p != NULL; p = matcher.find(p + 1, end)) {
+        ++count;
+    }
+
+    return count;
+}
+
+template <typename Function>
+double secondsFor(Function function, size_t & result) {
+    auto start = chrono::steady_clock::now();
+    result = function();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// g++ -O2 -o matcher-bench matcher-bench.cpp -Wall -Werror
+// usage: ./matcher-bench [megabytes]
+// Compares std::string::find with the wgrep matcher over random lowercase text
+// that has each term planted every 64 KB.
+int main(int argc, char* argv[]) {
+    size_t megabytes = argc > 1 ? atoi(argv[1]) : 64;
+    vector<string> terms = { "ab", "wgrep", "needle in a haystack", string(64, 'q') + "needle" };
+
+    mt19937 random(150);
+    string text(megabytes << 20, ' ');
+
+    for (char & letter : text) {
+        letter = 'a' + random() % 27;
+        if (letter > 'z') letter = '\n';
+    }
+
+    for (const string & term : terms) {
+        for (size_t pos = 0; pos + term.size() < text.size(); pos += 1 << 16) {
+            text.replace(pos, term.size(), term);
+        }
+    }
+
+    printf("%-12s %12s %12s %10s\n", "term length", "find MB/s", "matcher MB/s", "speedup");
+
+    for (const string & term : terms) {
+        unique_ptr<Matcher> matcher = makeMatcher(term);
+        size_t expected, actual;
+
+        double stdSeconds = secondsFor([&] { return countStd(text, term); }, expected);
+        double matcherSeconds = secondsFor([&] { return countMatcher(text, *matcher); }, actual);
+
+        if (expected != actual) {
+            printf("mismatch for \"%s\": %zu vs %zu\n", term.c_str(), expected, actual);
+            return 1;
+        }
+
+        printf("%-12zu %12.0f %12.0f %9.1fx\n", term.size(),
+               megabytes / stdSeconds, megabytes / matcherSeconds, stdSeconds / matcherSeconds);
+    }
+
+    return 0;
+}
@@ -0,0 +1,334 @@
+#ifndef _MATCHER_H_
+#define _MATCHER_H_
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Finds a search term in a buffer. A matcher is chosen once per term and then
+// run over whole buffers, not line by line.
+class Matcher {
+ public:
+  virtual ~Matcher() {}
+
+  // Returns the start of the first match in [begin, end), or NULL if there is none
+  virtual const char *find(const char *begin, const char *end) const = 0;
+};
+
+// The empty term matches everywhere
+class EmptyMatcher : public Matcher {
+ public:
+  const char *find(const char *begin, const char *end) const {
+    return begin < end ? begin : NULL;
+  }
+};
+
+// A term spanning lines can never match a single line
+class NeverMatcher : public Matcher {
+ public:
+  const char *find(const char *, const char *) const {
+    return NULL;
+  }
+};
+
+class ByteMatcher : public Matcher {
+ public:
+  ByteMatcher(char letter) : letter(letter) {}
+
+  const char *find(const char *begin, const char *end) const {
+    return (const char *) memchr(begin, letter, end - begin);
+  }
+
+ private:
+  char letter;
+};
+
+inline unsigned char foldCase(unsigned char letter) {
+  return letter >= 'A' && letter <= 'Z' ? letter + ('a' - 'A') : letter;
+}
+
+inline unsigned char upperCase(unsigned char letter) {
+  return letter >= 'a' && letter <= 'z' ? letter - ('a' - 'A') : letter;
+}
+
+inline bool isWordByte(unsigned char letter) {
+  return (letter >= 'a' && letter <= 'z') || (letter >= 'A' && letter <= 'Z') || (letter >= '0' && letter <= '9') || letter == '_';
+}
+
+// For -w: the match [start, start + length) must not touch a word byte on
+// either side. begin is the start of a line, so nothing before it counts.
+inline bool isWholeWord(const char *begin, const char *end, const char *start, size_t length) {
+  return (start == begin || !isWordByte(start[-1])) && (start + length == end || !isWordByte(start[length]));
+}
+
+// Candidates are positions where both the first and the last byte of the term
+// match, found 16 at a time with SSE2 (each compared against both cases for
+// -i) and then verified in full. Whatever SIMD cannot cover, or every position
+// without SSE2, goes through Horspool.
+class SubstringMatcher : public Matcher {
+ public:
+  SubstringMatcher(const std::string &term, bool ignoreCase, bool wholeWord)
+      : term(term), ignoreCase(ignoreCase), wholeWord(wholeWord) {
+    size_t n = term.size();
+
+    if (ignoreCase) {
+      for (char &letter : this->term) {
+        letter = foldCase(letter);
+      }
+    }
+
+    for (int i = 0; i < 256; ++i) {
+      shift[i] = n;
+    }
+    for (size_t i = 0; i + 1 < n; ++i) {
+      shift[(unsigned char) this->term[i]] = n - 1 - i;
+      if (ignoreCase) shift[upperCase(this->term[i])] = n - 1 - i;
+    }
+  }
+
+  const char *find(const char *begin, const char *end) const {
+    size_t n = term.size();
+    const char *p = begin;
+
+    if ((size_t) (end - begin) < n) {
+      return NULL;
+    }
+
+#ifdef __SSE2__
+    unsigned char first = term[0], last = term[n - 1];
+    const __m128i firstLower = _mm_set1_epi8(first);
+    const __m128i firstUpper = _mm_set1_epi8(ignoreCase ? upperCase(first) : first);
+    const __m128i lastLower = _mm_set1_epi8(last);
+    const __m128i lastUpper = _mm_set1_epi8(ignoreCase ? upperCase(last) : last);
+
+    // p + 15 is the last candidate in the block, and its match must fit
+    while (end - p >= (ptrdiff_t) (n + 15)) {
+      __m128i blockFirst = _mm_loadu_si128((const __m128i *) p);
+      __m128i blockLast = _mm_loadu_si128((const __m128i *) (p + n - 1));
+      __m128i firstEqual = _mm_or_si128(_mm_cmpeq_epi8(blockFirst, firstLower), _mm_cmpeq_epi8(blockFirst, firstUpper));
+      __m128i lastEqual = _mm_or_si128(_mm_cmpeq_epi8(blockLast, lastLower), _mm_cmpeq_epi8(blockLast, lastUpper));
+      unsigned mask = _mm_movemask_epi8(_mm_and_si128(firstEqual, lastEqual));
+
+      while (mask != 0) {
+        int bit = __builtin_ctz(mask);
+
+        if (matchesAt(begin, end, p + bit)) {
+          return p + bit;
+        }
+
+        mask &= mask - 1;
+      }
+
+      p += 16;
+    }
+#endif
+
+    return horspool(begin, end, p);
+  }
+
+ private:
+  // Whether the term is at candidate, which has room for it
+  bool matchesAt(const char *begin, const char *end, const char *candidate) const {
+    size_t n = term.size();
+
+    if (!ignoreCase) {
+      if (memcmp(candidate, term.data(), n) != 0) return false;
+    }
+    else {
+      for (size_t i = 0; i < n; ++i) {
+        if (foldCase(candidate[i]) != (unsigned char) term[i]) return false;
+      }
+    }
+
+    return !wholeWord || isWholeWord(begin, end, candidate, n);
+  }
+
+  const char *horspool(const char *begin, const char *end, const char *p) const {
+    size_t n = term.size();
+    unsigned char last = term[n - 1];
+
+    while (end - p >= (ptrdiff_t) n) {
+      unsigned char lastByte = p[n - 1];
+
+      if ((lastByte == last || (ignoreCase && foldCase(lastByte) == last)) && matchesAt(begin, end, p)) {
+        return p;
+      }
+
+      p += shift[lastByte];
+    }
+
+    return NULL;
+  }
+
+  std::string term; // folded for -i
+  bool ignoreCase;
+  bool wholeWord;
+  size_t shift[256];
+};
+
+// Finds any of several terms in one pass. The trie is turned into a full DFA,
+// so each input byte costs one table lookup whatever the number of terms.
+// Bytes are first mapped to classes, one for each byte some term uses and one
+// for all others, so a state has a transition per class rather than per byte
+// value, and large term lists stay small. For -i the terms are folded and
+// each upper-case letter shares its lower-case letter's class.
+class AhoCorasickMatcher : public Matcher {
+ public:
+  AhoCorasickMatcher(const std::vector<std::string> &terms, bool ignoreCase, bool wholeWord)
+      : wholeWord(wholeWord) {
+    // Class 0 is for the bytes no term uses
+    classCount = 1;
+    memset(byteClass, 0, sizeof(byteClass));
+
+    for (const std::string &term : terms) {
+      for (unsigned char letter : term) {
+        if (ignoreCase) letter = foldCase(letter);
+        if (byteClass[letter] == 0) byteClass[letter] = classCount++;
+      }
+    }
+
+    if (ignoreCase) {
+      for (int letter = 'a'; letter <= 'z'; ++letter) {
+        byteClass[upperCase(letter)] = byteClass[letter];
+      }
+    }
+
+    addState();
+
+    for (const std::string &term : terms) {
+      int32_t state = 0;
+
+      for (unsigned char letter : term) {
+        if (ignoreCase) letter = foldCase(letter);
+
+        int32_t edge = state * classCount + byteClass[letter];
+
+        if (next[edge] == 0) {
+          int32_t child = addState();
+          next[edge] = child;
+        }
+        state = next[edge];
+      }
+
+      termLength[state] = term.size();
+    }
+
+    // Breadth first, so fail links always point at finished states
+    std::vector<int32_t> fail(termLength.size(), 0);
+    std::vector<int32_t> queue;
+
+    for (int letterClass = 0; letterClass < classCount; ++letterClass) {
+      if (next[letterClass] != 0) queue.push_back(next[letterClass]);
+    }
+
+    for (size_t i = 0; i < queue.size(); ++i) {
+      int32_t state = queue[i];
+
+      outputLink[state] = termLength[fail[state]] != 0 ? fail[state] : outputLink[fail[state]];
+      matchLength[state] = termLength[state] != 0 ? termLength[state] : termLength[outputLink[state]];
+
+      for (int letterClass = 0; letterClass < classCount; ++letterClass) {
+        int32_t &child = next[state * classCount + letterClass];
+
+        if (child != 0) {
+          fail[child] = next[fail[state] * classCount + letterClass];
+          queue.push_back(child);
+        }
+        else {
+          child = next[fail[state] * classCount + letterClass];
+        }
+      }
+    }
+  }
+
+  const char *find(const char *begin, const char *end) const {
+    int32_t state = 0;
+
+    for (const char *p = begin; p < end; ++p) {
+      state = next[state * classCount + byteClass[(unsigned char) *p]];
+
+      if (matchLength[state] == 0) {
+        continue;
+      }
+      if (!wholeWord) {
+        return p + 1 - matchLength[state];
+      }
+
+      // Any of the terms ending here may be the whole word
+      int32_t match = termLength[state] != 0 ? state : outputLink[state];
+
+      for (; match != 0; match = outputLink[match]) {
+        const char *start = p + 1 - termLength[match];
+
+        if (isWholeWord(begin, end, start, termLength[match])) {
+          return start;
+        }
+      }
+    }
+
+    return NULL;
+  }
+
+ private:
+  int32_t addState() {
+    termLength.push_back(0);
+    outputLink.push_back(0);
+    matchLength.push_back(0);
+    next.resize(next.size() + classCount, 0);
+    return termLength.size() - 1;
+  }
+
+  bool wholeWord;
+  int32_t classCount; // up to 257, if the terms use every byte value
+  uint16_t byteClass[256];
+  std::vector<int32_t> next; // classCount transitions per state
+  std::vector<int32_t> termLength; // length of the term this state spells, or 0
+  std::vector<int32_t> outputLink; // nearest proper suffix state that spells a term, or 0
+  std::vector<int32_t> matchLength; // length of some term ending in this state, or 0
+};
+
+inline std::unique_ptr<Matcher> makeMatcher(const std::string &term, bool ignoreCase = false, bool wholeWord = false) {
+  if (term.empty()) {
+    return std::unique_ptr<Matcher>(new EmptyMatcher());
+  }
+  if (term.find('\n') != std::string::npos) {
+    return std::unique_ptr<Matcher>(new NeverMatcher());
+  }
+  if (term.size() == 1 && !wholeWord && (!ignoreCase || foldCase(term[0]) == upperCase(term[0]))) {
+    return std::unique_ptr<Matcher>(new ByteMatcher(term[0]));
+  }
+
+  return std::unique_ptr<Matcher>(new SubstringMatcher(term, ignoreCase, wholeWord));
+}
+
+// A line matches if it contains any of the terms
+inline std::unique_ptr<Matcher> makeMatcher(const std::vector<std::string> &terms, bool ignoreCase = false,
+                                             bool wholeWord = false) {
+  std::vector<std::string> usable;
+
+  for (const std::string &term : terms) {
+    if (term.empty()) {
+      return std::unique_ptr<Matcher>(new EmptyMatcher());
+    }
+    if (term.find('\n') == std::string::npos) {
+      usable.push_back(term);
+    }
+  }
+
+  if (usable.empty()) {
+    return std::unique_ptr<Matcher>(new NeverMatcher());
+  }
+  if (usable.size() == 1) {
+    return makeMatcher(usable[0], ignoreCase, wholeWord);
+  }
+
+  return std::unique_ptr<Matcher>(new AhoCorasickMatcher(usable, ignoreCase, wholeWord));
+}
+
+#endif
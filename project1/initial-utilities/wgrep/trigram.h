@@ -0,0 +1,459 @@
+#ifndef _TRIGRAM_H_
+#define _TRIGRAM_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "matcher.h"
+
+// On-disk trigram index for wgrep. Each indexed file is cut into fixed-size
+// blocks, and every trigram of a line is credited to the block the line starts
+// in. A query intersects the posting lists of the term's trigrams to get the
+// blocks that may hold a matching line; only those are then searched.
+//
+// Trigrams are ASCII case-folded so that one index serves exact and -i
+// queries alike. The file is laid out to be used straight from mmap:
+//
+//   IndexHeader
+//   IndexedFile[fileCount]
+//   TrigramEntry[trigramCount]   sorted by trigram
+//   postings[postingBytes]       per trigram, its global block numbers in
+//                                order as varints of the gap from the last
+//   names[nameBytes]             file names, NUL terminated
+//
+// Blocks come in order as the files are read, so each posting list is
+// encoded as it grows. A block whose lines hold a NUL byte or more than
+// TRIGRAM_BLOCK_LIMIT distinct trigrams, as binary or random data does, gets
+// no postings; it is listed under ALWAYS_SEARCH instead, which every query
+// includes. Building then takes memory for at most that many trigrams per
+// block, and text, with a few thousand, indexes to a fraction of its size.
+
+const char TRIGRAM_INDEX_MAGIC[8] = { 'W', 'G', 'R', 'E', 'P', 'I', 'X', '3' };
+const uint64_t TRIGRAM_BLOCK_SIZE = 1 << 18;
+const size_t TRIGRAM_BLOCK_LIMIT = 1 << 16;
+const uint32_t ALWAYS_SEARCH = 1 << 24; // above every trigram, so it sorts last
+
+struct IndexHeader {
+  char magic[8];
+  uint32_t fileCount;
+  uint32_t trigramCount;
+  uint64_t blockSize;
+  uint64_t postingBytes;
+  uint64_t nameBytes;
+};
+
+struct IndexedFile {
+  uint64_t nameOffset;
+  uint64_t size;
+  int64_t mtime; // nanoseconds; with size, tells whether the file changed since indexing
+  uint32_t firstBlock;
+  uint32_t blockCount;
+};
+
+struct TrigramEntry {
+  uint32_t trigram;
+  uint32_t postingCount;
+  uint64_t postingOffset;
+};
+
+inline void appendVarint(std::string &bytes, uint32_t value) {
+  while (value >= 0x80) {
+    bytes.push_back((char) (value | 0x80));
+    value >>= 7;
+  }
+
+  bytes.push_back((char) value);
+}
+
+inline int64_t modifiedTime(const struct stat &info) {
+  return (int64_t) info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+}
+
+// The folded trigrams of a term, or none if it is too short to have any
+inline std::vector<uint32_t> termTrigrams(const std::string &term) {
+  std::vector<uint32_t> trigrams;
+
+  for (size_t i = 0; i + 3 <= term.size(); ++i) {
+    trigrams.push_back(foldCase(term[i]) << 16 | foldCase(term[i + 1]) << 8 | foldCase(term[i + 2]));
+  }
+
+  std::sort(trigrams.begin(), trigrams.end());
+  trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+
+  return trigrams;
+}
+
+// Builds the posting lists while the files are read
+class IndexBuilder {
+ public:
+  IndexBuilder() : seen((1 << 24) / 64, 0) {}
+
+  // Returns false if the file cannot be read
+  bool addFile(const char *fileName) {
+    int fileDescriptor = open(fileName, O_RDONLY);
+    struct stat info;
+
+    if (fileDescriptor < 0 || fstat(fileDescriptor, &info) < 0) {
+      if (fileDescriptor >= 0) close(fileDescriptor);
+      return false;
+    }
+
+    IndexedFile file;
+    file.nameOffset = names.size();
+    file.size = info.st_size;
+    file.mtime = modifiedTime(info);
+    file.firstBlock = blockCount;
+    file.blockCount = info.st_size / TRIGRAM_BLOCK_SIZE + 1;
+    files.push_back(file);
+    names.append(fileName, strlen(fileName) + 1);
+
+    char buffer[1 << 16];
+    ssize_t bytesRead;
+    uint64_t position = 0;
+    uint32_t window = 0;
+    int windowSize = 0; // bytes of the current line in window, up to 3
+    uint32_t lineBlock = blockCount;
+
+    while ((bytesRead = read(fileDescriptor, buffer, sizeof(buffer))) > 0) {
+      for (ssize_t i = 0; i < bytesRead; ++i, ++position) {
+        if (buffer[i] == '\n') {
+          windowSize = 0;
+          uint32_t nextBlock = file.firstBlock + (position + 1) / TRIGRAM_BLOCK_SIZE;
+
+          if (nextBlock != lineBlock) {
+            flushBlock(lineBlock);
+            lineBlock = nextBlock;
+          }
+
+          continue;
+        }
+
+        if (buffer[i] == '\0') {
+          unindexed = true;
+        }
+
+        window = (window << 8 | foldCase(buffer[i])) & 0xffffff;
+
+        if (++windowSize >= 3 && !unindexed) {
+          addTrigram(window);
+        }
+      }
+    }
+
+    flushBlock(lineBlock);
+    close(fileDescriptor);
+    blockCount += file.blockCount;
+
+    return true;
+  }
+
+  bool write(const char *indexName) {
+    std::vector<uint32_t> trigrams;
+
+    for (const auto &list : lists) {
+      trigrams.push_back(list.first);
+    }
+
+    std::sort(trigrams.begin(), trigrams.end());
+
+    std::vector<TrigramEntry> entries;
+    uint64_t postingBytes = 0;
+
+    for (uint32_t trigram : trigrams) {
+      const PostingList &list = lists[trigram];
+      entries.push_back(TrigramEntry{ trigram, list.count, postingBytes });
+      postingBytes += list.bytes.size();
+    }
+
+    IndexHeader header;
+    memcpy(header.magic, TRIGRAM_INDEX_MAGIC, sizeof(header.magic));
+    header.fileCount = files.size();
+    header.trigramCount = entries.size();
+    header.blockSize = TRIGRAM_BLOCK_SIZE;
+    header.postingBytes = postingBytes;
+    header.nameBytes = names.size();
+
+    int fileDescriptor = open(indexName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fileDescriptor < 0) {
+      return false;
+    }
+
+    // Posting lists are small, so they are gathered into larger writes
+    std::string pending;
+    bool written = writeAll(fileDescriptor, &header, sizeof(header)) &&
+                   writeAll(fileDescriptor, files.data(), files.size() * sizeof(IndexedFile)) &&
+                   writeAll(fileDescriptor, entries.data(), entries.size() * sizeof(TrigramEntry));
+
+    for (size_t i = 0; i < trigrams.size() && written; ++i) {
+      pending += lists[trigrams[i]].bytes;
+
+      if (pending.size() >= WRITE_SIZE || i + 1 == trigrams.size()) {
+        written = writeAll(fileDescriptor, pending.data(), pending.size());
+        pending.clear();
+      }
+    }
+
+    written = written && writeAll(fileDescriptor, names.data(), names.size());
+
+    return close(fileDescriptor) == 0 && written;
+  }
+
+ private:
+  void addTrigram(uint32_t trigram) {
+    uint64_t &word = seen[trigram / 64];
+    uint64_t bit = (uint64_t) 1 << (trigram % 64);
+
+    if (!(word & bit)) {
+      word |= bit;
+      blockTrigrams.push_back(trigram);
+      unindexed = blockTrigrams.size() > TRIGRAM_BLOCK_LIMIT;
+    }
+  }
+
+  void flushBlock(uint32_t block) {
+    for (uint32_t trigram : blockTrigrams) {
+      if (!unindexed) addPosting(trigram, block);
+      seen[trigram / 64] = 0;
+    }
+
+    if (unindexed) addPosting(ALWAYS_SEARCH, block);
+
+    blockTrigrams.clear();
+    unindexed = false;
+  }
+
+  void addPosting(uint32_t trigram, uint32_t block) {
+    PostingList &list = lists[trigram];
+
+    appendVarint(list.bytes, list.count == 0 ? block : block - list.lastBlock);
+    list.lastBlock = block;
+    ++list.count;
+  }
+
+  static bool writeAll(int fileDescriptor, const void *data, size_t size) {
+    const char *bytes = (const char *) data;
+
+    while (size > 0) {
+      ssize_t bytesWritten = ::write(fileDescriptor, bytes, size);
+
+      if (bytesWritten <= 0) {
+        return false;
+      }
+
+      bytes += bytesWritten;
+      size -= bytesWritten;
+    }
+
+    return true;
+  }
+
+  // The blocks of one trigram so far, encoded as in the index
+  struct PostingList {
+    uint32_t count = 0;
+    uint32_t lastBlock = 0;
+    std::string bytes;
+  };
+
+  static constexpr size_t WRITE_SIZE = 1 << 20;
+
+  std::vector<uint64_t> seen; // one bit per trigram of the block being built
+  std::vector<uint32_t> blockTrigrams;
+  bool unindexed = false; // the block being built is to be searched whatever the query
+  std::unordered_map<uint32_t, PostingList> lists;
+  std::vector<IndexedFile> files;
+  std::string names;
+  uint32_t blockCount = 0;
+};
+
+// A mapped index file
+class TrigramIndex {
+ public:
+  ~TrigramIndex() {
+    if (data != NULL) munmap((void *) data, size);
+  }
+
+  bool open(const char *indexName) {
+    int fileDescriptor = ::open(indexName, O_RDONLY);
+    struct stat info;
+
+    if (fileDescriptor < 0 || fstat(fileDescriptor, &info) < 0 || (size_t) info.st_size < sizeof(IndexHeader)) {
+      if (fileDescriptor >= 0) close(fileDescriptor);
+      return false;
+    }
+
+    void *mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    close(fileDescriptor);
+
+    if (mapped == MAP_FAILED) {
+      return false;
+    }
+
+    data = (const char *) mapped;
+    size = info.st_size;
+    header = (const IndexHeader *) data;
+
+    return isValid();
+  }
+
+  uint32_t fileCount() const { return header->fileCount; }
+  uint64_t blockSize() const { return header->blockSize; }
+  const IndexedFile &file(uint32_t i) const { return files[i]; }
+
+  const char *fileName(uint32_t i) const {
+    return names + files[i].nameOffset;
+  }
+
+  // Whether the file still looks the way it did when it was indexed
+  bool isCurrent(uint32_t i) const {
+    struct stat info;
+    return stat(fileName(i), &info) == 0 && (uint64_t) info.st_size == files[i].size && modifiedTime(info) == files[i].mtime;
+  }
+
+  // Sorted blocks that may hold a line containing any of the terms, or
+  // everything if some term has no trigram to narrow by
+  std::vector<uint32_t> candidateBlocks(const std::vector<std::string> &terms) const {
+    std::vector<uint32_t> result = postingList(ALWAYS_SEARCH);
+
+    for (const std::string &term : terms) {
+      std::vector<uint32_t> trigrams = termTrigrams(term);
+
+      if (trigrams.empty()) {
+        return allBlocks();
+      }
+
+      std::vector<uint32_t> blocks = postingList(trigrams[0]);
+
+      for (size_t i = 1; i < trigrams.size() && !blocks.empty(); ++i) {
+        std::vector<uint32_t> next = postingList(trigrams[i]), both;
+        std::set_intersection(blocks.begin(), blocks.end(), next.begin(), next.end(), std::back_inserter(both));
+        blocks.swap(both);
+      }
+
+      std::vector<uint32_t> merged;
+      std::set_union(result.begin(), result.end(), blocks.begin(), blocks.end(), std::back_inserter(merged));
+      result.swap(merged);
+    }
+
+    return result;
+  }
+
+ private:
+  // Checks that every section lies inside the file where the header says,
+  // and that what the queries rely on holds, so that a damaged index is
+  // rejected rather than read out of bounds
+  bool isValid() {
+    if (memcmp(header->magic, TRIGRAM_INDEX_MAGIC, sizeof(header->magic)) != 0 || header->blockSize == 0) {
+      return false;
+    }
+
+    // Counts are 32 bits, so these sums cannot overflow before the checks
+    uint64_t filesEnd = sizeof(IndexHeader) + (uint64_t) header->fileCount * sizeof(IndexedFile);
+    uint64_t entriesEnd = filesEnd + (uint64_t) header->trigramCount * sizeof(TrigramEntry);
+
+    if (entriesEnd > size || header->postingBytes > size - entriesEnd
+        || header->nameBytes != size - entriesEnd - header->postingBytes) {
+      return false;
+    }
+
+    files = (const IndexedFile *) (header + 1);
+    entries = (const TrigramEntry *) (data + filesEnd);
+    postings = (const unsigned char *) (data + entriesEnd);
+    names = data + entriesEnd + header->postingBytes;
+
+    if (header->fileCount > 0 && (header->nameBytes == 0 || names[header->nameBytes - 1] != '\0')) {
+      return false;
+    }
+
+    uint64_t nextBlock = 0;
+
+    for (uint32_t i = 0; i < header->fileCount; ++i) {
+      if (files[i].nameOffset >= header->nameBytes || files[i].firstBlock != nextBlock
+          || files[i].blockCount != files[i].size / header->blockSize + 1) {
+        return false;
+      }
+
+      nextBlock += files[i].blockCount;
+    }
+
+    for (uint32_t i = 0; i < header->trigramCount; ++i) {
+      // Every posting takes at least a byte
+      if (entries[i].postingOffset > header->postingBytes
+          || entries[i].postingCount > header->postingBytes - entries[i].postingOffset
+          || (i > 0 && entries[i].trigram <= entries[i - 1].trigram)) {
+        return false;
+      }
+    }
+
+    return nextBlock <= UINT32_MAX;
+  }
+
+  std::vector<uint32_t> postingList(uint32_t trigram) const {
+    const TrigramEntry *end = entries + header->trigramCount;
+    const TrigramEntry *entry = std::lower_bound(entries, end, trigram,
+        [](const TrigramEntry &entry, uint32_t value) { return entry.trigram < value; });
+
+    if (entry == end || entry->trigram != trigram) {
+      return std::vector<uint32_t>();
+    }
+
+    // Decoding stops at the end of the postings, or at a block out of order,
+    // either of which only a damaged list has
+    std::vector<uint32_t> blocks;
+    const unsigned char *next = postings + entry->postingOffset;
+    const unsigned char *postingsEnd = postings + header->postingBytes;
+    uint64_t block = 0;
+
+    while (blocks.size() < entry->postingCount && next < postingsEnd) {
+      uint64_t gap = 0;
+      int shift = 0;
+
+      while (next < postingsEnd && (*next & 0x80) && shift < 28) {
+        gap |= (uint64_t) (*next++ & 0x7f) << shift;
+        shift += 7;
+      }
+
+      if (next == postingsEnd) break;
+      gap |= (uint64_t) *next++ << shift;
+
+      block += gap;
+      if (block > UINT32_MAX || (!blocks.empty() && gap == 0)) break;
+
+      blocks.push_back(block);
+    }
+
+    return blocks;
+  }
+
+  std::vector<uint32_t> allBlocks() const {
+    std::vector<uint32_t> blocks;
+
+    for (uint32_t i = 0; i < header->fileCount; ++i) {
+      for (uint32_t block = 0; block < files[i].blockCount; ++block) {
+        blocks.push_back(files[i].firstBlock + block);
+      }
+    }
+
+    return blocks;
+  }
+
+  const char *data = NULL;
+  size_t size = 0;
+  const IndexHeader *header = NULL;
+  const IndexedFile *files = NULL;
+  const TrigramEntry *entries = NULL;
+  const unsigned char *postings = NULL;
+  const char *names = NULL;
+};
+
+#endif
@@ -2,105 +2,659 @@
 #include <cstring>
 #include <iostream>
 #include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <limits> // for numeric_limits
 
+#include <cerrno> // for errno
 #include <fcntl.h> // for open
+#include <getopt.h> // for getopt_long
+#include <sys/stat.h> // for fstat
 #include <unistd.h> // for write, read, close
 
+#include "matcher.h"
+#include "trigram.h"
+
 using namespace std;
 
-void searchLine(string & line, string & searchTerm) {
-    size_t pos = line.find(searchTerm);
+const size_t BUFFER_SIZE = 1 << 17;
+const int JOBS_AHEAD_PER_THREAD = 4; // jobs searched ahead of the one being printed
+const size_t OUTPUT_BUFFER_SIZE = 1 << 20;
+const off_t RANGE_SIZE = 4 << 20; // piece of a large file one thread searches
 
-    if (pos != string::npos) {
-        // cout << line << endl;
-        line.push_back('\n');
+// Writes all of buffer, retrying short writes
+void writeAll(const char* buffer, size_t size) {
+    while (size > 0) {
+        ssize_t bytesWritten = write(STDOUT_FILENO, buffer, sizeof(char) * size);
 
-        char buffer[line.size() + 1];
-        strcpy(buffer, line.c_str());
+        if (bytesWritten < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
 
-        write(STDOUT_FILENO, buffer, sizeof(char) * line.size());
+        buffer += bytesWritten;
+        size -= bytesWritten;
     }
 }
 
-void searchLine(vector<char> & line, string & searchTerm) {
-    string content(line.begin(), line.end());
+// Collects matching lines so that dense matches cost a few writes per
+// megabyte. With autoFlush the buffer goes to stdout whenever it fills, or
+// after every line if stdout is a terminal; without, everything waits for
+// flush() so that a file searched out of order can be printed in its turn.
+class Output {
+ public:
+    Output(bool autoFlush) : autoFlush(autoFlush), eachLine(autoFlush && isatty(STDOUT_FILENO)) {}
 
-    searchLine(content, searchTerm);
+    void append(const char* data, size_t size) {
+        if (autoFlush && text.size() + size > OUTPUT_BUFFER_SIZE) {
+            flush();
 
-    line.clear();
-}
+            // Too big to be worth copying
+            if (size >= OUTPUT_BUFFER_SIZE) {
+                writeAll(data, size);
+                return;
+            }
+        }
 
-void searchInput(string & searchTerm) {
-    vector<char> line;
+        text.append(data, size);
 
-    char buffer;
-    
-    while (read(STDIN_FILENO, &buffer, sizeof(char)) > 0) {
-        if (buffer == '\n') {
-            searchLine(line, searchTerm);
+        if (eachLine) {
+            flush();
+        }
+    }
+
+    // Writes what has collected so far, unless it must wait for its turn
+    void flushReady() {
+        if (autoFlush && !text.empty()) {
+            flush();
+        }
+    }
+
+    void flush() {
+        writeAll(text.data(), text.size());
+
+        if (autoFlush) {
+            text.clear();
         }
         else {
-            line.push_back(buffer);
+            string().swap(text);
         }
     }
+
+ private:
+    bool autoFlush;
+    bool eachLine;
+    string text;
+};
+
+// What becomes of matching lines: printed, only counted (-c), or only whether
+// there is one at all (-l)
+enum Mode { PRINT_LINES, COUNT_LINES, LIST_FILES };
+
+struct Search {
+    const Matcher & matcher;
+    Mode mode;
+};
+
+// Searches every line in [begin, end), where end is just past a '\n', and
+// passes matching lines to output straight out of the buffer. The matcher runs
+// over the whole span, and a line is only delimited once it holds a match.
+// Returns the number of matching lines, stopping at the first for -l.
+size_t searchLines(const char* begin, const char* end, const Search & search, Output & output) {
+    size_t matches = 0;
+
+    while (begin < end) {
+        const char* match = search.matcher.find(begin, end);
+
+        if (match == NULL) {
+            break;
+        }
+
+        ++matches;
+
+        if (search.mode == LIST_FILES) {
+            break;
+        }
+
+        const char* lineEnd = (const char*) memchr(match, '\n', end - match);
+
+        if (search.mode == PRINT_LINES) {
+            const char* lineStart = (const char*) memrchr(begin, '\n', match - begin);
+            lineStart = lineStart == NULL ? begin : lineStart + 1;
+
+            output.append(lineStart, lineEnd + 1 - lineStart);
+        }
+
+        begin = lineEnd + 1;
+    }
+
+    return matches;
 }
 
-void searchFile(int fileDescriptor, string & searchTerm) {
-    int bufferSize = 8192;
-    char buffer[bufferSize + 1];
-    int bytesRead;
+// Reads a file sequentially, or only the bytes [offset, stop) with pread
+struct Source {
+    int fileDescriptor;
+    off_t offset = 0;
+    off_t stop = -1; // -1 reads to EOF with read()
+    bool streaming = false; // a pipe or terminal, which may deliver lines slowly
+
+    ssize_t readSome(char* buffer, size_t size) {
+        if (stop < 0) {
+            return read(fileDescriptor, buffer, size);
+        }
+
+        // A range can lie wholly inside a line that an earlier range owns
+        if (offset >= stop) return 0;
+        size = min((off_t) size, stop - offset);
+
+        ssize_t bytesRead = pread(fileDescriptor, buffer, size, offset);
+        if (bytesRead > 0) offset += bytesRead;
+
+        return bytesRead;
+    }
+};
+
+size_t searchSource(Source & source, const Search & search, Output & output) {
+    vector<char> buffer(BUFFER_SIZE);
+    size_t matches = 0;
+    size_t pending = 0; // bytes of an unfinished line kept at the front of buffer
+    ssize_t bytesRead;
+
+    while ((bytesRead = source.readSome(buffer.data() + pending, buffer.size() - pending)) > 0) {
+        char* start = buffer.data();
+        char* end = start + pending + bytesRead;
 
-    vector<char> line;
+        // The pending bytes hold no newline, so only the new ones need scanning
+        char* lastNewline = (char*) memrchr(start + pending, '\n', bytesRead);
 
-    while ((bytesRead = read(fileDescriptor, buffer, bufferSize)) > 0) {
-        buffer[bytesRead] = '\0'; // ensure null termination
+        if (lastNewline == NULL) {
+            pending += bytesRead;
 
-        for (int i = 0; i < bufferSize; ++i) {
-            if (buffer[i] == '\0') {
-                break;
+            // A line longer than the buffer
+            if (pending == buffer.size()) {
+                buffer.resize(buffer.size() * 2);
             }
-            else if (buffer[i] == '\n') {
-                searchLine(line, searchTerm);
+
+            continue;
+        }
+
+        matches += searchLines(start, lastNewline + 1, search, output);
+
+        // A short read from a pipe means the writer has nothing more for now,
+        // so what matched should not wait for a full buffer, or for EOF
+        if (source.streaming && (size_t) bytesRead < buffer.size() - pending) {
+            output.flushReady();
+        }
+
+        // -l needs no more of the file
+        if (search.mode == LIST_FILES && matches > 0) {
+            return matches;
+        }
+
+        // Only the line straddling the end of the buffer is copied
+        pending = end - (lastNewline + 1);
+        memmove(start, lastNewline + 1, pending);
+    }
+
+    // In case last line has no trailing \n
+    if (pending > 0) {
+        if (pending == buffer.size()) {
+            buffer.resize(buffer.size() + 1);
+        }
+
+        buffer[pending] = '\n';
+        matches += searchLines(buffer.data(), buffer.data() + pending + 1, search, output);
+    }
+
+    return matches;
+}
+
+size_t searchFile(int fileDescriptor, const Search & search, Output & output) {
+    struct stat info;
+    Source source{fileDescriptor};
+
+    source.streaming = fstat(fileDescriptor, &info) != 0 || !S_ISREG(info.st_mode);
+    return searchSource(source, search, output);
+}
+
+// Returns the offset just past the first '\n' in [position, limit), or limit
+// if there is none, or the file size if the file ends first
+off_t nextLineStart(int fileDescriptor, off_t position, off_t limit) {
+    char buffer[8192];
+    ssize_t bytesRead;
+
+    while (position < limit
+           && (bytesRead = pread(fileDescriptor, buffer, min((off_t) sizeof(buffer), limit - position), position)) > 0) {
+        char* newline = (char*) memchr(buffer, '\n', bytesRead);
+
+        if (newline != NULL) {
+            return position + (newline - buffer) + 1;
+        }
+
+        position += bytesRead;
+    }
+
+    return position;
+}
+
+// Searches the lines of a regular file that start in [start, stop). Ranges
+// cut anywhere, so each range finds its own line boundaries: a line belongs to
+// the range holding its first byte. Only that range reads past stop, to the
+// end of its last line; one inside a long line looks no further than stop, so
+// a file with few newlines is still read about once.
+size_t searchRange(int fileDescriptor, off_t start, off_t stop, const Search & search, Output & output) {
+    Source source{fileDescriptor};
+    source.offset = start > 0 ? nextLineStart(fileDescriptor, start - 1, stop) : 0;
+
+    if (source.offset >= stop) {
+        return 0;
+    }
+
+    source.stop = nextLineStart(fileDescriptor, stop - 1, numeric_limits<off_t>::max());
+
+    return searchSource(source, search, output);
+}
+
+// The -c or -l line for one file; matching lines need none
+void printSummary(const char* fileName, size_t matches, const Search & search, bool showName, Output & output) {
+    string line;
+
+    if (search.mode == COUNT_LINES) {
+        line = (showName ? string(fileName) + ":" : "") + to_string(matches) + "\n";
+    }
+    else if (search.mode == LIST_FILES && matches > 0) {
+        line = string(fileName) + "\n";
+    }
+
+    output.append(line.data(), line.size());
+}
+
+void searchInput(const Search & search) {
+    Output output(true);
+    struct stat info;
+
+    // A pipe holds 64 KB by default, so each read would return at most that
+    // much; let the writer get a full block ahead of us. The pipe is shared
+    // with the writer, so one set larger already is left alone.
+    if (fstat(STDIN_FILENO, &info) == 0 && S_ISFIFO(info.st_mode)) {
+        int pipeSize = fcntl(STDIN_FILENO, F_GETPIPE_SZ);
+
+        if (pipeSize >= 0 && pipeSize < (int) BUFFER_SIZE) {
+            fcntl(STDIN_FILENO, F_SETPIPE_SZ, (int) BUFFER_SIZE);
+        }
+    }
+
+    size_t matches = searchFile(STDIN_FILENO, search, output);
+    printSummary("(standard input)", matches, search, false, output);
+    output.flush();
+}
+
+// One file of the command line, or one range of a large one, and what
+// searching it produced
+struct Job {
+    const char* fileName;
+    int fileIndex;
+    off_t start = 0;
+    off_t stop = -1; // -1 for the whole file, start for nothing
+    bool opened = false;
+    bool done = false;
+    size_t matches = 0;
+    Output output{false};
+};
+
+// Shared by the workers and the thread printing results
+struct JobQueue {
+    vector<Job> jobs;
+    size_t next = 0; // first job no worker has taken
+    size_t printed = 0; // first job not yet printed
+    size_t ahead; // how far workers may run past printed
+    bool stop = false;
+    vector<bool> fileMatched; // lets -l skip the other ranges of a file
+    mutex lock;
+    condition_variable changed;
+};
+
+void searchWorker(JobQueue & queue, const Search & search) {
+    unique_lock<mutex> guard(queue.lock);
+
+    while (true) {
+        queue.changed.wait(guard, [&] {
+            return queue.stop || queue.next >= queue.jobs.size() || queue.next < queue.printed + queue.ahead;
+        });
+
+        if (queue.stop || queue.next >= queue.jobs.size()) {
+            return;
+        }
+
+        Job & job = queue.jobs[queue.next++];
+        bool skip = job.start == job.stop || (search.mode == LIST_FILES && queue.fileMatched[job.fileIndex]);
+        guard.unlock();
+
+        int fileDescriptor = skip ? -1 : open(job.fileName, O_RDONLY);
+
+        if (skip) {
+            job.opened = true;
+        }
+        else if (fileDescriptor >= 0) {
+            job.opened = true;
+
+            if (job.stop < 0) {
+                job.matches = searchFile(fileDescriptor, search, job.output);
             }
             else {
-                line.push_back(buffer[i]);
+                job.matches = searchRange(fileDescriptor, job.start, job.stop, search, job.output);
+            }
+
+            close(fileDescriptor);
+        }
+
+        guard.lock();
+        if (job.matches > 0) queue.fileMatched[job.fileIndex] = true;
+        job.done = true;
+        queue.changed.notify_all();
+    }
+}
+
+// Reads one search term per line of a patterns file
+bool readPatterns(const char* fileName, vector<string> & terms) {
+    int fileDescriptor = open(fileName, O_RDONLY);
+
+    if (fileDescriptor < 0) {
+        return false;
+    }
+
+    string text;
+    char buffer[8192];
+    ssize_t bytesRead;
+
+    while ((bytesRead = read(fileDescriptor, buffer, sizeof(buffer))) > 0) {
+        text.append(buffer, bytesRead);
+    }
+
+    close(fileDescriptor);
+
+    size_t start = 0;
+
+    while (start < text.size()) {
+        size_t newline = text.find('\n', start);
+        if (newline == string::npos) newline = text.size();
+
+        terms.push_back(text.substr(start, newline - start));
+        start = newline + 1;
+    }
+
+    return true;
+}
+
+// One job per file, except that regular files larger than RANGE_SIZE are
+// split into ranges of that size. A job keeps its output until its turn to
+// print, and workers run at most ahead jobs past the one printing, so however
+// large the file, at most that many ranges' output is held at once.
+vector<Job> planJobs(char* fileNames[], int count) {
+    vector<Job> jobs;
+
+    for (int i = 0; i < count; ++i) {
+        struct stat info;
+
+        if (stat(fileNames[i], &info) != 0 || !S_ISREG(info.st_mode) || info.st_size <= RANGE_SIZE) {
+            jobs.push_back(Job());
+            jobs.back().fileName = fileNames[i];
+            jobs.back().fileIndex = i;
+            continue;
+        }
+
+        for (off_t start = 0; start < info.st_size; start += RANGE_SIZE) {
+            jobs.push_back(Job());
+            jobs.back().fileName = fileNames[i];
+            jobs.back().fileIndex = i;
+            jobs.back().start = start;
+            jobs.back().stop = min(start + RANGE_SIZE, info.st_size);
+        }
+    }
+
+    return jobs;
+}
+
+// Jobs for the indexed files: only runs of blocks that may hold a match, or
+// the whole file if it changed since it was indexed. A file with no candidate
+// block still gets an empty job so that -c can report it.
+vector<Job> planIndexedJobs(const TrigramIndex & index, const vector<string> & searchTerms) {
+    vector<uint32_t> blocks = index.candidateBlocks(searchTerms);
+    vector<Job> jobs;
+    size_t next = 0;
+
+    for (uint32_t i = 0; i < index.fileCount(); ++i) {
+        const IndexedFile & file = index.file(i);
+        uint32_t firstBlock = file.firstBlock;
+        uint32_t endBlock = file.firstBlock + file.blockCount;
+        size_t fileJobs = jobs.size();
+        bool current = index.isCurrent(i);
+
+        while (next < blocks.size() && blocks[next] < endBlock) {
+            size_t runEnd = next + 1;
+
+            while (runEnd < blocks.size() && blocks[runEnd] == blocks[runEnd - 1] + 1 && blocks[runEnd] < endBlock) {
+                ++runEnd;
+            }
+
+            if (current) {
+                jobs.push_back(Job());
+                jobs.back().start = (blocks[next] - firstBlock) * index.blockSize();
+                jobs.back().stop = min((blocks[runEnd - 1] - firstBlock + 1) * index.blockSize(), file.size);
             }
+
+            next = runEnd;
+        }
+
+        if (!current || jobs.size() == fileJobs) {
+            jobs.push_back(Job());
+            jobs.back().stop = current ? 0 : -1;
+        }
+
+        for (size_t job = fileJobs; job < jobs.size(); ++job) {
+            jobs[job].fileName = index.fileName(i);
+            jobs[job].fileIndex = i;
         }
     }
 
-    // In case last line has no trailing \n
-    searchLine(line, searchTerm);
+    return jobs;
 }
 
-// g++ -o wgrep wgrep.cpp -Wall -Werror
+// Searches the jobs on threads, printing matches in argv and file order
+int runJobs(vector<Job> jobs, int fileCount, const Search & search, int threadCount) {
+    JobQueue queue;
+    queue.ahead = threadCount * JOBS_AHEAD_PER_THREAD;
+    queue.jobs = move(jobs);
+    queue.fileMatched.assign(fileCount, false);
+
+    threadCount = min((size_t) threadCount, queue.jobs.size());
+    vector<thread> threads;
+
+    for (int i = 0; i < threadCount; ++i) {
+        threads.push_back(thread(searchWorker, ref(queue), ref(search)));
+    }
+
+    int result = 0;
+    size_t fileMatches = 0; // over the ranges of the current file so far
+
+    for (size_t i = 0; i < queue.jobs.size(); ++i) {
+        Job & job = queue.jobs[i];
+
+        unique_lock<mutex> guard(queue.lock);
+        queue.changed.wait(guard, [&] { return job.done; });
+        guard.unlock();
+
+        if (!job.opened) {
+            cout << "wgrep: cannot open file" << endl;
+            result = 1;
+            break;
+        }
+
+        fileMatches += job.matches;
+
+        if (i + 1 == queue.jobs.size() || queue.jobs[i + 1].fileIndex != job.fileIndex) {
+            printSummary(job.fileName, fileMatches, search, fileCount > 1, job.output);
+            fileMatches = 0;
+        }
+
+        job.output.flush();
+
+        guard.lock();
+        ++queue.printed;
+        queue.changed.notify_all();
+    }
+
+    {
+        lock_guard<mutex> guard(queue.lock);
+        queue.stop = true;
+        queue.changed.notify_all();
+    }
+
+    for (thread & worker : threads) {
+        worker.join();
+    }
+
+    return result;
+}
+
+// g++ -o wgrep wgrep.cpp -Wall -Werror -pthread
 // For this project, you are required to use the following routines to do file input and output: open, read, write, and close.
+// usage: wgrep [-j threads] [-c | -l] [-i] [-w] searchterm [file ...]
+//        wgrep [-j threads] [-c | -l] [-i] [-w] -f patternsfile [file ...]
+//        wgrep --build-index indexfile file ...
+//        wgrep [-j threads] [-c | -l] [-i] [-w] --index indexfile (searchterm | -f patternsfile)
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
+    int threadCount = 1;
+    const char* patternsFile = NULL;
+    const char* buildIndex = NULL;
+    const char* useIndex = NULL;
+    Mode mode = PRINT_LINES;
+    bool ignoreCase = false;
+    bool wholeWord = false;
+    int option;
+
+    const struct option longOptions[] = {
+        { "build-index", required_argument, NULL, 'B' },
+        { "index", required_argument, NULL, 'I' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    // "+" stops at the search term, so terms after it may start with '-'
+    while ((option = getopt_long(argc, argv, "+j:f:cliw", longOptions, NULL)) != -1) {
+        if (option == 'j' && atoi(optarg) > 0) {
+            threadCount = atoi(optarg);
+        }
+        else if (option == 'f') {
+            patternsFile = optarg;
+        }
+        else if (option == 'c') {
+            mode = COUNT_LINES;
+        }
+        else if (option == 'l') {
+            mode = LIST_FILES;
+        }
+        else if (option == 'i') {
+            ignoreCase = true;
+        }
+        else if (option == 'w') {
+            wholeWord = true;
+        }
+        else if (option == 'B') {
+            buildIndex = optarg;
+        }
+        else if (option == 'I') {
+            useIndex = optarg;
+        }
+        else {
+            cout << "wgrep: searchterm [file ...]" << endl;
+            return 1;
+        }
+    }
+
+    if (buildIndex != NULL) {
+        IndexBuilder builder;
+
+        for (int i = optind; i < argc; ++i) {
+            if (!builder.addFile(argv[i])) {
+                cout << "wgrep: cannot open file" << endl;
+                return 1;
+            }
+        }
+
+        if (!builder.write(buildIndex)) {
+            cout << "wgrep: cannot write index" << endl;
+            return 1;
+        }
+
+        return 0;
+    }
+
+    vector<string> searchTerms;
+
+    if (patternsFile != NULL) {
+        if (!readPatterns(patternsFile, searchTerms)) {
+            cout << "wgrep: cannot open file" << endl;
+            return 1;
+        }
+    }
+    else if (optind < argc) {
+        searchTerms.push_back(argv[optind++]);
+    }
+    else {
         cout << "wgrep: searchterm [file ...]" << endl;
         return 1;
     }
 
-    string searchTerm(argv[1]);
+    unique_ptr<Matcher> matcher = makeMatcher(searchTerms, ignoreCase, wholeWord);
+    Search search{*matcher, mode};
+
+    int fileCount = argc - optind;
+    char** fileNames = argv + optind;
+
+    if (useIndex != NULL) {
+        TrigramIndex index;
+
+        // The index decides which files are searched
+        if (fileCount > 0) {
+            cout << "wgrep: searchterm [file ...]" << endl;
+            return 1;
+        }
+        if (!index.open(useIndex)) {
+            cout << "wgrep: cannot open file" << endl;
+            return 1;
+        }
 
-    if (argc == 2) {
-        searchInput(searchTerm);
+        return runJobs(planIndexedJobs(index, searchTerms), index.fileCount(), search, threadCount);
+    }
+    else if (fileCount == 0) {
+        searchInput(search);
+    }
+    else if (threadCount > 1) {
+        return runJobs(planJobs(fileNames, fileCount), fileCount, search, threadCount);
     }
     else {
-        for (int i = 2; i < argc; ++i) {
-            const char* fileName = argv[i];
+        Output output(true);
+
+        for (int i = 0; i < fileCount; ++i) {
+            const char* fileName = fileNames[i];
             int fileDescriptor = open(fileName, O_RDONLY);
 
             if (fileDescriptor < 0) {
+                output.flush();
                 cout << "wgrep: cannot open file" << endl;
                 close(fileDescriptor);
                 return 1;
             }
             else {
-                searchFile(fileDescriptor, searchTerm);
+                size_t matches = searchFile(fileDescriptor, search, output);
+                printSummary(fileName, matches, search, fileCount > 1, output);
                 close(fileDescriptor);
             }
         }
+
+        output.flush();
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -1,47 +1,421 @@
 #include <iostream>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <atomic>
 
+#include <cerrno> // for errno
 #include <cstdint> // 4 byte int
-#include <fcntl.h> // for open
-#include <unistd.h> // for write, read, close
+#include <cstdlib> // for atoi, strtoull
+#include <fcntl.h> // for open, fcntl
+#include <getopt.h> // for getopt_long
+#include <sys/mman.h> // for mmap, madvise, munmap
+#include <sys/stat.h> // for stat
+#include <unistd.h> // for write, read, close, pread, pwrite, getopt, sysconf
+
+#include "../rle/rle.h"
 
 using namespace std;
 
-void unzipFile(int fileDescriptor) {
-    const int BUFFER_SIZE = 5;
-    const int LETTER_POS = 4;
-    unsigned char buffer[BUFFER_SIZE];
+const size_t BUFFER_SIZE = 1 << 17;
+const off_t MIN_PIECE_RECORDS = 1 << 20; // smallest share of records one thread decodes
+const int PIECES_PER_THREAD = 4;
+
+// Writes all of buffer, retrying short writes
+void writeAll(const char* buffer, size_t size) {
+    while (size > 0) {
+        ssize_t bytesWritten = write(STDOUT_FILENO, buffer, size);
 
-    while (read(fileDescriptor, buffer, BUFFER_SIZE) > 0) {
-        int count = *((int32_t*) buffer);
-        char letter = buffer[LETTER_POS];
-        for (int i = 0; i < count; ++i) {
-            // cout << letter;
-            write(STDOUT_FILENO, (void*) &letter, sizeof(char));
+        if (bytesWritten < 0) {
+            if (errno == EINTR) continue;
+            return;
         }
+
+        buffer += bytesWritten;
+        size -= bytesWritten;
+    }
+}
+
+// Writes all of buffer to stdout at offset, leaving the file offset alone
+void pwriteAll(const char* buffer, size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t bytesWritten = pwrite(STDOUT_FILENO, buffer, size, offset);
+
+        if (bytesWritten < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+
+        buffer += bytesWritten;
+        size -= bytesWritten;
+        offset += bytesWritten;
     }
 }
 
-// g++ -o wunzip wunzip.cpp -Wall -Werror
+// Decoded bytes go to the current position of stdout
+struct StdoutSink {
+    void operator()(const char* data, size_t size) const {
+        writeAll(data, size);
+    }
+};
+
+// Decoded bytes go to stdout from offset on, with pwrite
+struct PositionalSink {
+    off_t offset;
+
+    void operator()(const char* data, size_t size) {
+        pwriteAll(data, size, offset);
+        offset += size;
+    }
+};
+
+typedef RleDecoder<StdoutSink> Decoder;
+
+// Decodes size bytes of a regular file from offset on straight out of a
+// mapping, with no copy into a read buffer. Returns false, having decoded
+// nothing, if the file cannot be mapped.
+bool unzipMapped(int fileDescriptor, Decoder & decoder, off_t offset, off_t size) {
+    off_t pageStart = offset & ~(off_t) (sysconf(_SC_PAGESIZE) - 1);
+    off_t length = size + (offset - pageStart);
+
+    if (size == 0) return true;
+    if ((off_t) (size_t) length != length) return false;
+
+    void* mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fileDescriptor, pageStart);
+
+    if (mapping == MAP_FAILED) return false;
+
+    madvise(mapping, length, MADV_SEQUENTIAL);
+    decoder.feed((const char*) mapping + (offset - pageStart), size);
+    munmap(mapping, length);
+
+    return true;
+}
+
+// Decodes at most limit bytes from the current position of a file as the
+// stream the decoder was started on. A limit comes from measuring a regular
+// file, which is mapped; otherwise (limit negative, or the mapping fails) the
+// file is read to its end, or up to limit, in large blocks.
+void unzipFile(int fileDescriptor, Decoder & decoder, off_t limit = -1) {
+    static char buffer[BUFFER_SIZE];
+    ssize_t bytesRead;
+    off_t position = limit > 0 ? lseek(fileDescriptor, 0, SEEK_CUR) : -1;
+
+    if (position >= 0 && unzipMapped(fileDescriptor, decoder, position, limit)) {
+        return;
+    }
+
+    while (!decoder.isFull() && limit != 0) {
+        size_t wanted = limit < 0 ? BUFFER_SIZE : min((off_t) BUFFER_SIZE, limit);
+
+        if ((bytesRead = read(fileDescriptor, buffer, wanted)) <= 0) break;
+
+        decoder.feed(buffer, bytesRead);
+        if (limit > 0) limit -= bytesRead;
+    }
+}
+
+// Reads the index of a regular file written by wzip -x into checkpoints, and
+// returns how many bytes come before it: the whole file if there is no index,
+// or -1 if the file cannot be measured
+off_t readIndex(int fileDescriptor, vector<RleCheckpoint> & checkpoints) {
+    struct stat info;
+    char footer[RLE_FOOTER_SIZE];
+    uint64_t count;
+
+    if (fstat(fileDescriptor, &info) != 0 || !S_ISREG(info.st_mode)) {
+        return -1;
+    }
+    if (info.st_size < RLE_FOOTER_SIZE
+        || pread(fileDescriptor, footer, RLE_FOOTER_SIZE, info.st_size - RLE_FOOTER_SIZE) != RLE_FOOTER_SIZE
+        || !rleReadFooter(footer, count)
+        || count > (uint64_t) (info.st_size - RLE_FOOTER_SIZE) / sizeof(RleCheckpoint)) {
+        return info.st_size;
+    }
+
+    size_t size = count * sizeof(RleCheckpoint);
+    off_t indexStart = info.st_size - RLE_FOOTER_SIZE - size;
+    checkpoints.resize(count);
+
+    if (pread(fileDescriptor, checkpoints.data(), size, indexStart) != (ssize_t) size) {
+        checkpoints.clear();
+        return info.st_size;
+    }
+
+    return indexStart;
+}
+
+// Decodes the bytes [start, start + length) of a file's output, beginning
+// at the last checkpoint before start if the file has an index, or at the
+// beginning of the file otherwise
+void unzipRange(int fileDescriptor, uint64_t start, uint64_t length) {
+    vector<RleCheckpoint> checkpoints;
+    off_t dataSize = readIndex(fileDescriptor, checkpoints);
+    RleCheckpoint from{0, 0};
+    RleFormat format = RLE_UNKNOWN;
+
+    for (const RleCheckpoint & checkpoint : checkpoints) {
+        if (checkpoint.uncompressed > start) break;
+        from = checkpoint;
+    }
+
+    if (from.compressed > 0) {
+        char magic[RLE_MAGIC_SIZE];
+        bool compact = pread(fileDescriptor, magic, RLE_MAGIC_SIZE, 0) == RLE_MAGIC_SIZE
+            && rleIsCompact(magic, RLE_MAGIC_SIZE);
+
+        format = compact ? RLE_COMPACT : RLE_LEGACY;
+        lseek(fileDescriptor, from.compressed, SEEK_SET);
+    }
+
+    unique_ptr<Decoder> decoder(new Decoder());
+    decoder->startStream(format);
+    decoder->setWindow(start - from.uncompressed, length);
+    unzipFile(fileDescriptor, *decoder, dataSize < 0 ? -1 : dataSize - (off_t) from.compressed);
+    decoder->flush();
+}
+
+// Whether a file is in the compact format, judging by its first bytes
+bool isCompactFile(const char* fileName) {
+    char magic[RLE_MAGIC_SIZE];
+    int fileDescriptor = open(fileName, O_RDONLY);
+
+    if (fileDescriptor < 0) {
+        return false;
+    }
+
+    ssize_t bytesRead = pread(fileDescriptor, magic, RLE_MAGIC_SIZE, 0);
+    close(fileDescriptor);
+
+    return bytesRead == RLE_MAGIC_SIZE && rleIsCompact(magic, RLE_MAGIC_SIZE);
+}
+
+// A share of one file's records and where their output goes
+struct Piece {
+    int fileDescriptor;
+    off_t firstRecord;
+    off_t recordCount;
+    int64_t size = 0; // bytes of output
+    off_t offset = 0;
+};
+
+// Calls visit(letter, count) for each record of a piece, in order
+template <typename Visit>
+void readRecords(const Piece & piece, Visit visit) {
+    const size_t blockSize = BUFFER_SIZE / RLE_RECORD_SIZE * RLE_RECORD_SIZE;
+    vector<char> buffer(blockSize);
+    off_t position = piece.firstRecord * RLE_RECORD_SIZE;
+    off_t end = position + piece.recordCount * RLE_RECORD_SIZE;
+
+    while (position < end) {
+        ssize_t bytesRead = pread(piece.fileDescriptor, buffer.data(), min((off_t) blockSize, end - position), position);
+        size_t records = bytesRead > 0 ? bytesRead / RLE_RECORD_SIZE : 0;
+
+        if (records == 0) return;
+
+        for (size_t i = 0; i < records; ++i) {
+            int32_t count;
+            memcpy(&count, buffer.data() + i * RLE_RECORD_SIZE, sizeof(int32_t));
+            visit(buffer[i * RLE_RECORD_SIZE + RLE_LETTER_POS], count);
+        }
+
+        position += records * RLE_RECORD_SIZE;
+    }
+}
+
+// Runs work on every piece, spread over threadCount threads
+template <typename Work>
+void forEachPiece(vector<Piece> & pieces, int threadCount, Work work) {
+    atomic<size_t> next(0);
+    vector<thread> threads;
+
+    for (int i = 0; i < threadCount; ++i) {
+        threads.push_back(thread([&] {
+            size_t piece;
+
+            while ((piece = next++) < pieces.size()) {
+                work(pieces[piece]);
+            }
+        }));
+    }
+
+    for (thread & worker : threads) {
+        worker.join();
+    }
+}
+
+// Positional writes need stdout to be a regular file that is not appended to
+bool canWriteAt(int fileDescriptor) {
+    struct stat info;
+
+    return fstat(fileDescriptor, &info) == 0 && S_ISREG(info.st_mode)
+        && !(fcntl(fileDescriptor, F_GETFL) & O_APPEND) && lseek(fileDescriptor, 0, SEEK_CUR) >= 0;
+}
+
+// Every record is 5 bytes, so the files split into pieces of whole records
+// without reading them. One pass sums the run lengths of each piece, a prefix
+// sum over the pieces gives each its place in the output, and a second pass
+// decodes the pieces in parallel straight into the output file. stdout is
+// left positioned after the output, as if it had been written sequentially.
+int unzipParallel(char* fileNames[], int count, int threadCount) {
+    off_t base = lseek(STDOUT_FILENO, 0, SEEK_CUR);
+    vector<int> fileDescriptors;
+    vector<off_t> recordCounts;
+    off_t totalRecords = 0;
+    int result = 0;
+
+    for (int i = 0; i < count; ++i) {
+        int fileDescriptor = open(fileNames[i], O_RDONLY);
+        if (fileDescriptor < 0) {
+            result = 1;
+            break;
+        }
+
+        vector<RleCheckpoint> checkpoints;
+
+        fileDescriptors.push_back(fileDescriptor);
+        recordCounts.push_back(readIndex(fileDescriptor, checkpoints) / RLE_RECORD_SIZE);
+        totalRecords += recordCounts.back();
+    }
+
+    off_t pieceRecords = max(MIN_PIECE_RECORDS, totalRecords / (threadCount * PIECES_PER_THREAD) + 1);
+    vector<Piece> pieces;
+
+    for (size_t i = 0; i < fileDescriptors.size(); ++i) {
+        for (off_t first = 0; first < recordCounts[i]; first += pieceRecords) {
+            pieces.push_back(Piece{fileDescriptors[i], first, min(pieceRecords, recordCounts[i] - first)});
+        }
+    }
+
+    threadCount = min((size_t) threadCount, pieces.size());
+
+    forEachPiece(pieces, threadCount, [](Piece & piece) {
+        readRecords(piece, [&](char, int32_t count) {
+            if (count > 0) piece.size += count;
+        });
+    });
+
+    off_t offset = base;
+
+    for (Piece & piece : pieces) {
+        piece.offset = offset;
+        offset += piece.size;
+    }
+
+    forEachPiece(pieces, threadCount, [](Piece & piece) {
+        unique_ptr<RleDecoder<PositionalSink>> decoder(new RleDecoder<PositionalSink>(PositionalSink{piece.offset}));
+
+        readRecords(piece, [&](char letter, int32_t count) {
+            decoder->addRun(letter, count);
+        });
+
+        decoder->flush();
+    });
+
+    lseek(STDOUT_FILENO, offset, SEEK_SET);
+
+    for (int fileDescriptor : fileDescriptors) {
+        close(fileDescriptor);
+    }
+
+    if (result != 0) {
+        cout << "wunzip: cannot open file" << endl;
+    }
+
+    return result;
+}
+
+// g++ -o wunzip wunzip.cpp -Wall -Werror -pthread
 // For this project, you are required to use the following routines to do file input and output: open, read, write, and close.
+// usage: wunzip [-j threads] file1 [file2 ...]
+//        wunzip --range start:length file
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
+    int threadCount = 1;
+    const char* range = NULL;
+    int option;
+
+    const struct option longOptions[] = {
+        { "range", required_argument, NULL, 'r' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    while ((option = getopt_long(argc, argv, "+j:", longOptions, NULL)) != -1) {
+        if (option == 'j' && atoi(optarg) > 0) {
+            threadCount = atoi(optarg);
+        }
+        else if (option == 'r') {
+            range = optarg;
+        }
+        else {
+            cout << "wunzip: file1 [file2 ...]" << endl;
+            return 1;
+        }
+    }
+
+    if (optind >= argc) {
         cout << "wunzip: file1 [file2 ...]" << endl;
         return 1;
     }
 
-    for (int i = 1; i < argc; ++i) {
+    if (range != NULL) {
+        char* colon;
+        char* end = NULL;
+        uint64_t start = strtoull(range, &colon, 10);
+        uint64_t length = *colon == ':' ? strtoull(colon + 1, &end, 10) : 0;
+
+        if (*colon != ':' || colon == range || end == colon + 1 || *end != '\0' || optind + 1 != argc) {
+            cout << "wunzip: --range start:length file" << endl;
+            return 1;
+        }
+
+        int fileDescriptor = open(argv[optind], O_RDONLY);
+
+        if (fileDescriptor < 0) {
+            cout << "wunzip: cannot open file" << endl;
+            return 1;
+        }
+
+        unzipRange(fileDescriptor, start, length);
+        close(fileDescriptor);
+
+        return 0;
+    }
+
+    // Anything but legacy regular files in and a regular file out is decoded
+    // sequentially; compact tokens vary in size, so their offsets are unknown
+    // until the tokens before them have been read
+    bool parallel = threadCount > 1 && canWriteAt(STDOUT_FILENO);
+
+    for (int i = optind; parallel && i < argc; ++i) {
+        struct stat info;
+        parallel = stat(argv[i], &info) != 0 || (S_ISREG(info.st_mode) && !isCompactFile(argv[i]));
+    }
+
+    if (parallel) {
+        return unzipParallel(argv + optind, argc - optind, threadCount);
+    }
+
+    static Decoder decoder;
+
+    for (int i = optind; i < argc; ++i) {
         const char* fileName = argv[i];
         int fileDescriptor = open(fileName, O_RDONLY);
 
         if (fileDescriptor < 0) {
+            decoder.flush();
             cout << "wunzip: cannot open file" << endl;
             close(fileDescriptor);
             return 1;
         }
 
-        unzipFile(fileDescriptor);
+        vector<RleCheckpoint> checkpoints;
+        decoder.startStream();
+        unzipFile(fileDescriptor, decoder, readIndex(fileDescriptor, checkpoints));
         close(fileDescriptor);
     }
 
+    decoder.flush();
+
     return 0;
-}
\ No newline at end of file
+}
@@ -1,57 +1,283 @@
+#include <string>
+#include <cstring>
 #include <iostream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
+#include <cerrno> // for errno
 #include <cstdint> // 4 byte int
+#include <cstdlib> // for atoi
 #include <fcntl.h> // for open
-#include <unistd.h> // for write, read, close
+#include <sys/stat.h> // for stat
+#include <unistd.h> // for write, read, close, getopt
+
+#include "../rle/rle.h"
 
 using namespace std;
 
-void output(char letter, int32_t count) {
-    write(STDOUT_FILENO, (void*) &count, sizeof(int32_t));
-    write(STDOUT_FILENO, (void*) &letter, sizeof(char));
+const size_t BUFFER_SIZE = 1 << 17;
+const size_t OUTPUT_BUFFER_SIZE = 1 << 16;
+const off_t CHUNK_SIZE = 4 << 20; // piece of a regular file one thread encodes
+const int CHUNKS_AHEAD_PER_THREAD = 2; // chunks encoded ahead of the one being written
+
+// Writes all of buffer, retrying short writes
+void writeAll(const char* buffer, size_t size) {
+    while (size > 0) {
+        ssize_t bytesWritten = write(STDOUT_FILENO, buffer, size);
+
+        if (bytesWritten < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+
+        buffer += bytesWritten;
+        size -= bytesWritten;
+    }
+}
+
+// Writes what the encoder has produced so far
+void writeOutput(RleEncoder & encoder) {
+    writeAll(encoder.output(), encoder.outputSize());
+    encoder.clearOutput();
+}
+
+// One file of the command line, or one range of a regular file, and the
+// records encoding it
+struct Chunk {
+    const char* fileName;
+    off_t start = 0;
+    off_t stop = -1; // -1 for the whole file
+    bool opened = false;
+    bool done = false;
+    RleEncoder encoder;
+};
+
+// Shared by the workers and the thread writing results
+struct ChunkQueue {
+    vector<Chunk> chunks;
+    size_t next = 0; // first chunk no worker has taken
+    size_t written = 0; // first chunk not yet written
+    size_t ahead; // how far workers may run past written
+    bool stop = false;
+    mutex lock;
+    condition_variable changed;
+};
+
+void encodeChunk(int fileDescriptor, Chunk & chunk) {
+    vector<char> buffer(BUFFER_SIZE);
+    off_t offset = chunk.start;
+    ssize_t bytesRead;
+
+    while (true) {
+        if (chunk.stop < 0) {
+            bytesRead = read(fileDescriptor, buffer.data(), BUFFER_SIZE);
+        }
+        else if (offset < chunk.stop) {
+            bytesRead = pread(fileDescriptor, buffer.data(), min((off_t) BUFFER_SIZE, chunk.stop - offset), offset);
+        }
+        else {
+            bytesRead = 0;
+        }
+
+        if (bytesRead <= 0) break;
+
+        chunk.encoder.feed(buffer.data(), bytesRead);
+        offset += bytesRead;
+    }
 }
 
-// g++ -o wzip wzip.cpp -Wall -Werror
+void encodeWorker(ChunkQueue & queue) {
+    unique_lock<mutex> guard(queue.lock);
+
+    while (true) {
+        queue.changed.wait(guard, [&] {
+            return queue.stop || queue.next >= queue.chunks.size() || queue.next < queue.written + queue.ahead;
+        });
+
+        if (queue.stop || queue.next >= queue.chunks.size()) {
+            return;
+        }
+
+        Chunk & chunk = queue.chunks[queue.next++];
+        guard.unlock();
+
+        int fileDescriptor = open(chunk.fileName, O_RDONLY);
+
+        if (fileDescriptor >= 0) {
+            chunk.opened = true;
+            encodeChunk(fileDescriptor, chunk);
+            chunk.encoder.endLiteral();
+            close(fileDescriptor);
+        }
+
+        guard.lock();
+        chunk.done = true;
+        queue.changed.notify_all();
+    }
+}
+
+// Regular files are cut into CHUNK_SIZE ranges; anything else is one chunk
+vector<Chunk> planChunks(char* fileNames[], int count, RleFormat format, uint64_t checkpointInterval) {
+    vector<Chunk> chunks;
+
+    for (int i = 0; i < count; ++i) {
+        struct stat info;
+
+        if (stat(fileNames[i], &info) != 0 || !S_ISREG(info.st_mode)) {
+            chunks.emplace_back();
+            chunks.back().fileName = fileNames[i];
+            chunks.back().encoder = RleEncoder(format, true, checkpointInterval);
+            continue;
+        }
+
+        off_t start = 0;
+
+        do {
+            chunks.emplace_back();
+            chunks.back().fileName = fileNames[i];
+            chunks.back().encoder = RleEncoder(format, true, checkpointInterval);
+            chunks.back().start = start;
+            chunks.back().stop = min(start + CHUNK_SIZE, info.st_size);
+            start += CHUNK_SIZE;
+        } while (start < info.st_size);
+    }
+
+    return chunks;
+}
+
+// Encodes the chunks on threads and joins them in order. Each chunk's runs
+// are complete except its first and last, which may continue a run from the
+// chunk before or into the one after, so those two go through the writing
+// encoder while everything between is copied out as is. Legacy output is
+// byte-identical to the sequential encoder's; compact output may also split
+// a literal block where a chunk ends, which decodes the same. Each chunk
+// notes checkpoints from its own start, and the writing encoder keeps those
+// that fit its interval, so an index may differ slightly from a sequential
+// run's but is as dense.
+int runChunks(vector<Chunk> chunks, RleFormat format, uint64_t checkpointInterval, int threadCount) {
+    ChunkQueue queue;
+    queue.ahead = threadCount * CHUNKS_AHEAD_PER_THREAD;
+    queue.chunks = move(chunks);
+
+    threadCount = min((size_t) threadCount, queue.chunks.size());
+    vector<thread> threads;
+
+    for (int i = 0; i < threadCount; ++i) {
+        threads.push_back(thread(encodeWorker, ref(queue)));
+    }
+
+    RleEncoder encoder(format, false, checkpointInterval);
+    int result = 0;
+
+    encoder.startStream();
+
+    for (Chunk & chunk : queue.chunks) {
+        unique_lock<mutex> guard(queue.lock);
+        queue.changed.wait(guard, [&] { return chunk.done; });
+        guard.unlock();
+
+        if (!chunk.opened) {
+            encoder.endLiteral();
+            writeOutput(encoder);
+            cout << "wzip: cannot open file" << endl;
+            result = 1;
+            break;
+        }
+
+        encoder.addRun(chunk.encoder.firstRun.letter, chunk.encoder.firstRun.count);
+        if (chunk.encoder.outputSize() > 0) encoder.append(chunk.encoder);
+        encoder.addRun(chunk.encoder.run.letter, chunk.encoder.run.count);
+        chunk.encoder = RleEncoder();
+        writeOutput(encoder);
+
+        guard.lock();
+        ++queue.written;
+        queue.changed.notify_all();
+    }
+
+    if (result == 0) {
+        encoder.finish();
+        writeOutput(encoder);
+    }
+
+    {
+        lock_guard<mutex> guard(queue.lock);
+        queue.stop = true;
+        queue.changed.notify_all();
+    }
+
+    for (thread & worker : threads) {
+        worker.join();
+    }
+
+    return result;
+}
+
+// g++ -o wzip wzip.cpp -Wall -Werror -pthread
 // For this project, you are required to use the following routines to do file input and output: open, read, write, and close.
+// usage: wzip [-j threads] [-2] [-x interval] file1 [file2 ...]
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
+    int threadCount = 1;
+    RleFormat format = RLE_LEGACY;
+    uint64_t checkpointInterval = 0;
+    int option;
+
+    while ((option = getopt(argc, argv, "+j:2x:")) != -1) {
+        if (option == 'j' && atoi(optarg) > 0) {
+            threadCount = atoi(optarg);
+        }
+        else if (option == '2') {
+            format = RLE_COMPACT;
+        }
+        else if (option == 'x' && atoll(optarg) > 0) {
+            checkpointInterval = atoll(optarg);
+        }
+        else {
+            cout << "wzip: file1 [file2 ...]" << endl;
+            return 1;
+        }
+    }
+
+    if (optind >= argc) {
         cout << "wzip: file1 [file2 ...]" << endl;
         return 1;
     }
 
-    const int BUFFER_SIZE = 1;
-    
-    int32_t count = 0;
-    char currChar = '\0';
-    char buffer[BUFFER_SIZE];
+    if (threadCount > 1) {
+        return runChunks(planChunks(argv + optind, argc - optind, format, checkpointInterval), format,
+                         checkpointInterval, threadCount);
+    }
+
+    RleEncoder encoder(format, false, checkpointInterval);
+    static char buffer[BUFFER_SIZE];
+    ssize_t bytesRead;
 
-    for (int i = 1; i < argc; ++i) {
+    encoder.startStream();
+
+    for (int i = optind; i < argc; ++i) {
         const char* fileName = argv[i];
         int fileDescriptor = open(fileName, O_RDONLY);
 
         if (fileDescriptor < 0) {
+            encoder.endLiteral();
+            writeOutput(encoder);
             cout << "wzip: cannot open file" << endl;
             close(fileDescriptor);
             return 1;
         }
 
-        while (read(fileDescriptor, buffer, BUFFER_SIZE) > 0) {
-            char letter = buffer[0];
-            
-            if (letter == currChar) {
-                ++count;
-            }
-            else {
-                if (currChar != '\0') output(currChar, count);
-                count = 1;
-                currChar = letter;
-            }
+        while ((bytesRead = read(fileDescriptor, buffer, BUFFER_SIZE)) > 0) {
+            encoder.feed(buffer, bytesRead);
+            if (encoder.outputSize() >= OUTPUT_BUFFER_SIZE) writeOutput(encoder);
         }
 
         close(fileDescriptor);
     }
 
-    output(currChar, count);
+    encoder.finish();
+    writeOutput(encoder);
 
     return 0;
-}
\ No newline at end of file
+}
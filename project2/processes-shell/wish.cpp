@@ -2,40 +2,21 @@
 #include <istream> // for base in class
 #include <fstream> // for ifstream
 #include <sstream> // for istringstream
-#include <unistd.h> // for getpid()
-#include <sys/wait.h> // for wait()
+#include <unistd.h> // for access(), pipe2(), environ
+#include <sys/wait.h> // for waitpid()
+#include <spawn.h> // for posix_spawn()
 #include <memory> // for unique_ptr
-#include <fcntl.h> // for open()
+#include <fcntl.h> // for O_CREAT, O_CLOEXEC, splice()
 #include <vector>
+#include <unordered_map> // for the command path cache
 #include <cstring>
+#include <cstdlib> // for strtol()
+#include <cerrno> // for errno
 
 #include <error.h>
 
 using namespace std;
 
-char** vectorOfStringToCharArray(const std::vector<std::string>& vec) {
-    // Allocate memory for the array of char pointers
-    char** charArray = new char*[vec.size() + 1]; // +1 for nullptr at the end
-
-    // Populate the array with dynamically allocated char arrays
-    for (size_t i = 0; i < vec.size(); ++i) {
-        charArray[i] = new char[vec[i].size() + 1]; // +1 for null terminator
-        strcpy(charArray[i], vec[i].c_str());
-    }
-
-    charArray[vec.size()] = nullptr;
-
-    return charArray;
-}
-
-// Function to deallocate memory allocated for char**
-void deallocateCharArray(char** charArray, size_t size) {
-    for (size_t i = 0; i < size; ++i) {
-        delete[] charArray[i];
-    }
-    delete[] charArray;
-}
-
 string trim(const string& str) {
     size_t start = 0;
     size_t end = str.length();
@@ -78,6 +59,312 @@ void printErr() {
     cerr << "An error has occurred\n";
 }
 
+// Finds the first directory of searchPaths holding an executable cmd and
+// returns its full path, or an empty string if there is none. Found commands
+// are remembered in commandPaths, which must be cleared whenever searchPaths
+// changes, or the working directory does while searchPaths has a relative
+// directory; misses are not, so a command added to the path later is found.
+string resolveCommand(const string& cmd, const vector<string>& searchPaths,
+                      unordered_map<string, string>& commandPaths) {
+    auto cached = commandPaths.find(cmd);
+
+    if (cached != commandPaths.end()) {
+        return cached->second;
+    }
+
+    for (const string& path : searchPaths) {
+        string candidate = path + "/" + cmd;
+
+        // Check if program exists in path
+        if (access(candidate.c_str(), X_OK) == 0) {
+            commandPaths[cmd] = candidate;
+            return candidate;
+        }
+    }
+
+    return "";
+}
+
+// Starts program with args, reading from input and writing to output, or to
+// fileToRedirectTo if redirectToFile, and returns its pid, or -1 if it could
+// not be started.
+// posix_spawn can start the child without copying the shell's page tables,
+// unlike fork, and the redirection is done as one of its file actions.
+pid_t spawnCommand(const string& program, const vector<string>& args, bool redirectToFile,
+                   const string& fileToRedirectTo, int input = STDIN_FILENO, int output = STDOUT_FILENO) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+
+    if (input != STDIN_FILENO) {
+        posix_spawn_file_actions_adddup2(&actions, input, STDIN_FILENO);
+    }
+
+    if (output != STDOUT_FILENO) {
+        posix_spawn_file_actions_adddup2(&actions, output, STDOUT_FILENO);
+    }
+
+    if (redirectToFile) {
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, fileToRedirectTo.c_str(),
+                                         O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+
+    // execv does not change its arguments, so they can point into args
+    vector<char*> argv;
+
+    for (const string& arg : args) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+
+    argv.push_back(nullptr);
+
+    pid_t pid;
+    int error = posix_spawn(&pid, program.c_str(), &actions, NULL, argv.data(), environ);
+
+    posix_spawn_file_actions_destroy(&actions);
+
+    errno = error;
+    return error == 0 ? pid : -1;
+}
+
+// Starts args[0] from the file resolveCommand finds for it, like
+// spawnCommand. If a cached file has gone since it was found, the entry is
+// dropped and the command looked up again, so a later directory of the path
+// can still supply it.
+pid_t spawnFromPath(const vector<string>& args, const vector<string>& searchPaths,
+                    unordered_map<string, string>& commandPaths, bool redirectToFile,
+                    const string& fileToRedirectTo, int input = STDIN_FILENO, int output = STDOUT_FILENO) {
+    string program = resolveCommand(args[0], searchPaths, commandPaths);
+
+    if (program == "") {
+        return -1;
+    }
+
+    pid_t pid = spawnCommand(program, args, redirectToFile, fileToRedirectTo, input, output);
+
+    if (pid < 0 && errno == ENOENT) {
+        commandPaths.erase(args[0]);
+        program = resolveCommand(args[0], searchPaths, commandPaths);
+
+        if (program != "") {
+            pid = spawnCommand(program, args, redirectToFile, fileToRedirectTo, input, output);
+        }
+    }
+
+    return pid;
+}
+
+// Whether a directory of searchPaths is relative to the working directory
+bool hasRelativePath(const vector<string>& searchPaths) {
+    for (const string& path : searchPaths) {
+        if (path.empty() || path[0] != '/') {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Copies input to output until input ends, the way cat with no arguments
+// would, and returns cat's exit status. Both are pipes, so splice moves the
+// bytes from one pipe buffer to the other without them passing through user
+// memory. Writing after the reader has gone raises SIGPIPE, as it does in cat.
+int passThrough(int input, int output) {
+    while (true) {
+        ssize_t moved = splice(input, NULL, output, NULL, 1 << 16, SPLICE_F_MOVE);
+
+        if (moved == 0) {
+            return 0;
+        }
+
+        if (moved < 0 && errno != EINTR) {
+            return 1;
+        }
+    }
+}
+
+// Starts a child that runs passThrough in place of a cat stage that reads
+// and writes pipes, and returns its pid, or -1. It is a process of its own,
+// so the pipeline's pids and exit status are those of a real cat, but it
+// needs no exec. unused is the read end of its own output pipe, which the
+// child must close, or the stage before would never see the stage after exit.
+pid_t spawnPassThrough(int input, int output, int unused) {
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        close(unused);
+        _exit(passThrough(input, output));
+    }
+
+    return pid;
+}
+
+// Whether a stage is cat with no arguments, copying its input unchanged
+bool isPassThrough(const vector<string>& args) {
+    return args.size() == 1 && args[0] == "cat";
+}
+
+// Parses the commands of a pipeline into the arguments of each stage, or
+// returns false if one is empty, a builtin or not in the search path.
+bool planPipeline(const vector<string>& commands, const vector<string>& searchPaths,
+                  unordered_map<string, string>& commandPaths, vector<vector<string>>& stages) {
+    for (const string& command : commands) {
+        vector<string> args = split(command, ' ');
+        string cmd = args[0];
+
+        if (cmd == "" || cmd == "exit" || cmd == "cd" || cmd == "path" || cmd == "jobs") {
+            return false;
+        }
+
+        if (resolveCommand(cmd, searchPaths, commandPaths) == "") {
+            return false;
+        }
+
+        stages.push_back(args);
+    }
+
+    return true;
+}
+
+// Starts every stage of a pipeline without waiting for any, each reading
+// the output of the one before through a pipe, and adds their pids to
+// children. The pipes are close-on-exec, so only the stages they join keep
+// them open, and a stage sees end of file as soon as the one before exits.
+// A cat between two stages is run by spawnPassThrough instead.
+void spawnPipeline(const vector<vector<string>>& stages, const vector<string>& searchPaths,
+                   unordered_map<string, string>& commandPaths, bool redirectToFile,
+                   const string& fileToRedirectTo, vector<pid_t>& children) {
+    int input = STDIN_FILENO;
+
+    for (size_t i = 0; i < stages.size(); ++i) {
+        bool last = i + 1 == stages.size();
+        int fileDescriptors[2] = { -1, STDOUT_FILENO };
+
+        if (!last && pipe2(fileDescriptors, O_CLOEXEC) != 0) {
+            printErr();
+            break;
+        }
+
+        pid_t child;
+
+        if (input != STDIN_FILENO && !last && isPassThrough(stages[i])) {
+            child = spawnPassThrough(input, fileDescriptors[1], fileDescriptors[0]);
+        }
+        else {
+            child = spawnFromPath(stages[i], searchPaths, commandPaths, last && redirectToFile,
+                                  fileToRedirectTo, input, fileDescriptors[1]);
+        }
+
+        if (child < 0) {
+            printErr();
+        }
+        else {
+            children.push_back(child);
+        }
+
+        if (input != STDIN_FILENO) {
+            close(input);
+        }
+
+        if (!last) {
+            close(fileDescriptors[1]);
+        }
+
+        input = fileDescriptors[0];
+    }
+
+    if (input >= 0 && input != STDIN_FILENO) {
+        close(input);
+    }
+}
+
+// A command of a line, started as one or more processes
+struct Job {
+    string command;
+    pid_t lastPid; // the process whose status is the job's, as in a pipeline
+    int pidsLeft; // processes not yet reaped
+    int status = 0; // as from waitpid
+};
+
+// The jobs started for a line, of which at most a given number run at once
+struct JobTable {
+    vector<Job> jobs;
+    unordered_map<pid_t, size_t> jobOfPid;
+    int running = 0;
+
+    // Records the processes started for command as a job
+    void add(const string& command, const vector<pid_t>& pids) {
+        if (pids.empty()) {
+            return;
+        }
+
+        for (pid_t pid : pids) {
+            jobOfPid[pid] = jobs.size();
+        }
+
+        jobs.push_back(Job{ command, pids.back(), (int) pids.size() });
+        ++running;
+    }
+
+    // Waits for any child to exit and credits it to its job; returns false
+    // if there are no children left
+    bool reapOne() {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+
+        if (pid < 0) {
+            return false;
+        }
+
+        auto found = jobOfPid.find(pid);
+
+        if (found == jobOfPid.end()) {
+            return true;
+        }
+
+        Job& job = jobs[found->second];
+
+        if (pid == job.lastPid) {
+            job.status = status;
+        }
+
+        if (--job.pidsLeft == 0) {
+            --running;
+        }
+
+        jobOfPid.erase(found);
+        return true;
+    }
+
+    // Reaps children until fewer than maxJobs jobs run; 0 means no limit
+    void waitForSlot(long maxJobs) {
+        while (maxJobs > 0 && running >= maxJobs && reapOne()) {
+        }
+    }
+
+    void waitAll() {
+        while (running > 0 && reapOne()) {
+        }
+    }
+
+    // Prints how each job ended, in the order they were started
+    void report() const {
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            const Job& job = jobs[i];
+
+            cout << "[" << i + 1 << "] ";
+
+            if (WIFSIGNALED(job.status)) {
+                cout << "signal " << WTERMSIG(job.status);
+            }
+            else {
+                cout << "exit " << WEXITSTATUS(job.status);
+            }
+
+            cout << ": " << job.command << endl;
+        }
+    }
+};
+
 // g++ -o wish wish.cpp -Wall -Werror
 int main(int argc, char* argv[]) {
     unique_ptr<istream> in;
@@ -103,6 +390,9 @@ int main(int argc, char* argv[]) {
     }
 
     vector<string> searchPaths = { "/bin" };
+    unordered_map<string, string> commandPaths; // cmd -> full path, from searchPaths
+    long maxJobs = 0; // jobs of a line run at once, set with jobs -j; 0 for no limit
+    JobTable lastJobs; // of the last line that started any, for jobs
     
     while (true) {
         string line;
@@ -115,6 +405,7 @@ int main(int argc, char* argv[]) {
 
         istringstream iss(line);
         vector<string> inputs = split(line, '&');
+        JobTable lineJobs;
 
         for (string input : inputs) {
             if (input == "") {
@@ -141,6 +432,24 @@ int main(int argc, char* argv[]) {
                 }
             }
             
+            vector<string> commands = split(args[0], '|');
+
+            if (commands.size() > 1) {
+                vector<vector<string>> stages;
+
+                if (!planPipeline(commands, searchPaths, commandPaths, stages)) {
+                    printErr();
+                    continue;
+                }
+
+                vector<pid_t> children;
+
+                lineJobs.waitForSlot(maxJobs);
+                spawnPipeline(stages, searchPaths, commandPaths, redirectToFile, fileToRedirectTo, children);
+                lineJobs.add(input, children);
+                continue;
+            }
+
             args = split(args[0], ' ');
 
             int count = args.size();
@@ -167,53 +476,52 @@ int main(int argc, char* argv[]) {
                 if (count != 2 || chdir(args[1].c_str())) {
                     printErr();
                 }
+                else if (hasRelativePath(searchPaths)) {
+                    commandPaths.clear();
+                }
             }
             else if (cmd == "path") {
                 searchPaths = vector<string>(args.begin() + 1, args.end());
+                commandPaths.clear();
             }
-            else {
-                int ret = fork();
-
-                if (ret == 0) {
-                    // This is the child process
-                    for (string path : searchPaths) {
-                        // Check if program exists in path
-                        if (access((path + "/" + cmd).c_str(), X_OK)) {
-                            // Cannot access file
-                            continue;
-                        }
+            else if (cmd == "jobs") {
+                char* end = NULL;
+                long limit = count == 3 && args[1] == "-j" ? strtol(args[2].c_str(), &end, 10) : -1;
 
-                        if (redirectToFile) {
-                            int fileDescriptor = open(fileToRedirectTo.c_str(), O_WRONLY | O_CREAT);
-
-                            if (fileDescriptor < 0) {
-                                printErr();
-                                return 0;
-                            }
-
-                            dup2(fileDescriptor, STDOUT_FILENO);
-                        }
-
-                        char** args_exec = vectorOfStringToCharArray(args);
-
-                        execv((path + "/" + cmd).c_str(), args_exec);
+                if (count == 1) {
+                    lastJobs.report();
+                }
+                else if (limit >= 0 && end != args[2].c_str() && *end == '\0') {
+                    maxJobs = limit;
+                }
+                else {
+                    printErr();
+                }
+            }
+            else {
+                if (resolveCommand(cmd, searchPaths, commandPaths) == "") {
+                    // Could not find it within path, so there is nothing to fork
+                    printErr();
+                    continue;
+                }
 
-                        // execv returned -1, which is an error
-                        printErr();
+                lineJobs.waitForSlot(maxJobs);
 
-                        deallocateCharArray(args_exec, count);
-                        return 0;
-                    }
+                pid_t child = spawnFromPath(args, searchPaths, commandPaths, redirectToFile, fileToRedirectTo);
 
-                    // Could not execute within path, also an error
+                if (child < 0) {
                     printErr();
-                    return 0;
+                    continue;
                 }
+
+                lineJobs.add(input, { child });
             }
         }
 
-        for (size_t i = 0; i < inputs.size(); ++i) {
-            wait(NULL);
+        lineJobs.waitAll();
+
+        if (!lineJobs.jobs.empty()) {
+            lastJobs = lineJobs;
         }
     }
 